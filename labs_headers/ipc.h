@@ -0,0 +1,252 @@
+/**
+ * @file     ipc.h
+ * @brief    Extensions of message.h provided by the source build of
+ *           libdistributedmodel (see libdistributedmodel/)
+ */
+
+#ifndef ITMO_HDU_DISTRIBUTED_SYSTEMS_IPC_H
+#define ITMO_HDU_DISTRIBUTED_SYSTEMS_IPC_H
+
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#include "message.h"
+
+enum {
+    SEND_IOV_MAX = 16,      ///< max payload fragments per send_iov() call
+    MESSAGE_TYPES = TRANSFER_BATCH + 1, ///< number of MessageType values
+    GATHER_PART_MAX = MAX_PAYLOAD_LEN - sizeof(local_id)   ///< max bytes per gather() part
+};
+
+/** Bit of a message type in the masks of receive_any_of_view() */
+#define MESSAGE_TYPE_BIT(type)  (1u << (type))
+#define ALL_MESSAGE_TYPES       (~0u)
+
+//------------------------------------------------------------------------------
+
+/** Receive a message from the process specified by id without copying it.
+ *
+ * The returned message lives in the channel buffer and must be handed back
+ * with release_view() before the next receive of any kind.
+ *
+ * @param from    ID of the process to receive message from
+ *
+ * @return message view, terminate model on errors
+ */
+const Message * receive_view(local_id from);
+
+//------------------------------------------------------------------------------
+
+/** Receive a message from any process without copying it.
+ *
+ * @param from    Set to the ID of the sender, can be NULL
+ *
+ * @return message view, valid until release_view()
+ */
+const Message * receive_any_view(local_id * from);
+
+//------------------------------------------------------------------------------
+
+/** receive_any_view() that does not wait.
+ *
+ * @param from    Set to the ID of the sender, can be NULL
+ *
+ * @return message view, or NULL if no message is waiting
+ */
+const Message * try_receive_any_view(local_id * from);
+
+//------------------------------------------------------------------------------
+
+/** Receive the next message of one type from the process specified by id.
+ *
+ * Messages of other types that arrive first are kept in a mailbox per
+ * sender and type, and every receive hands them out later in the order
+ * they came.  Nothing is dropped.
+ *
+ * @param from    ID of the process to receive message from
+ * @param type    Type of message to wait for
+ *
+ * @return message view, valid until release_view()
+ */
+const Message * receive_type_view(local_id from, MessageType type);
+
+//------------------------------------------------------------------------------
+
+/** Receive the next message from any process whose type is in a mask.
+ *
+ * Keeps the other messages like receive_type_view().
+ *
+ * @param types   MESSAGE_TYPE_BIT()s of the wanted types
+ * @param from    Set to the ID of the sender, can be NULL
+ *
+ * @return message view, valid until release_view()
+ */
+const Message * receive_any_of_view(uint32_t types, local_id * from);
+
+//------------------------------------------------------------------------------
+
+/** receive_any_of_view() that does not wait.
+ *
+ * @return message view, or NULL if no wanted message is waiting
+ */
+const Message * try_receive_any_of_view(uint32_t types, local_id * from);
+
+//------------------------------------------------------------------------------
+
+/** Give a view obtained from one of the *_view() receives back to the
+ * transport.
+ *
+ * @param msg     The view to release
+ */
+void release_view(const Message * msg);
+
+//------------------------------------------------------------------------------
+
+/** Send a message whose payload is gathered from several buffers.
+ *
+ * Header and fragments go to the channel in one vectored write, so the
+ * payload is never staged in a Message buffer.
+ *
+ * @param dst     ID of recepient
+ * @param type    Type of message
+ * @param time    Timestamp of message
+ * @param iov     Payload fragments, can be NULL if iovcnt is 0
+ * @param iovcnt  Number of fragments, at most SEND_IOV_MAX
+ *
+ * @return 0 on success, terminate model on errors
+ */
+int send_iov(local_id dst, MessageType type, timestamp_t time,
+             const struct iovec * iov, int iovcnt);
+
+//------------------------------------------------------------------------------
+
+/** Multicast counterpart of send_iov().
+ *
+ * @return 0 on success, terminate model on errors
+ */
+int send_multicast_iov(MessageType type, timestamp_t time,
+                       const struct iovec * iov, int iovcnt);
+
+//------------------------------------------------------------------------------
+
+/** Turn coalescing of outgoing messages on or off.
+ *
+ * While it is on, messages to the same destination are queued and leave in
+ * one write once the process would block in a receive or calls flush().  Each receiver
+ * still sees exactly the same messages in the same order.  Turning it off
+ * flushes.
+ *
+ * @param enabled   true to start queueing
+ */
+void set_coalescing(bool enabled);
+
+//------------------------------------------------------------------------------
+
+/** Push every queued message to its channel. No-op without coalescing. */
+void flush(void);
+
+//------------------------------------------------------------------------------
+
+/** Handles one message, the view is released once it returns. */
+typedef void (*MessageHandler)(local_id from, const Message * msg);
+
+/** What run_reactor() does in one phase of a protocol. */
+typedef struct {
+    MessageHandler on[MESSAGE_TYPES];   ///< per type, NULL keeps it in its mailbox
+    void (*on_time)(timestamp_t time);  ///< clock update before each handler, can be NULL
+    void (*on_idle)(void);              ///< before waiting for input, can be NULL
+} Handlers;
+
+//------------------------------------------------------------------------------
+
+/** Dispatch incoming messages to handlers until done() returns true.
+ *
+ * done() is asked before every message.  Messages are read in place and
+ * handed out back to back while any channel has one; on_idle() runs only
+ * when all of them are empty, right before the reactor waits.  Messages
+ * of types without a handler wait in their mailboxes for a later phase
+ * (see receive_type_view()).
+ *
+ * @param handlers  handlers of the current phase
+ * @param done      end of the phase
+ */
+void run_reactor(const Handlers * handlers, bool (*done)(void));
+
+//------------------------------------------------------------------------------
+
+/** Wait until every process has reached the same phase.
+ *
+ * All processes, parent included, call it with the same phase, which is
+ * also the type of the messages it sends.  Every message of the calling
+ * process carries its payload, e.g. its STARTED or DONE log line; with
+ * all-to-all the parent sends none, as in the lab protocols.  The
+ * algorithm is picked by $DISTRIBUTED_MODEL_BARRIER: all-to-all
+ * (default), tree or dissemination.
+ *
+ * @param phase   Type of the barrier messages, e.g. STARTED or DONE
+ * @param time    Timestamp of this process's messages
+ * @param payload Payload of this process's messages, can be NULL if len is 0
+ * @param len     Payload length
+ *
+ * @return the latest of time and of the timestamps the barrier received
+ */
+timestamp_t barrier(MessageType phase, timestamp_t time, const void * payload, size_t len);
+
+//------------------------------------------------------------------------------
+
+/** Collectives over all processes, parent included.
+ *
+ * Every process calls them in the same order with the same type, root
+ * and sizes; their messages have that type and are taken with
+ * receive_type_view(), so anything else waits in its mailbox.  broadcast(),
+ * reduce() and gather() run along a binomial tree rooted at root, in
+ * ceil(log2 N) rounds with no process talking to more than log2 N others.
+ */
+
+/** Combines len bytes of in into acc, e.g. adds arrays element by element.
+ * Must be associative and commutative. */
+typedef void (*ReduceOp)(void * acc, const void * in, size_t len);
+
+/** Fills buf with the next part of this process's gather() contribution.
+ * @return part length, at most cap, or 0 once there is no more */
+typedef size_t (*GatherSource)(void * buf, size_t cap);
+
+/** Takes one part of the contribution of origin at the gather() root.
+ * Parts of one origin arrive in order, different origins interleave. */
+typedef void (*GatherSink)(local_id origin, const void * part, size_t len);
+
+/** Copy len bytes at data, at most MAX_PAYLOAD_LEN, from root to everybody. */
+void broadcast(local_id root, MessageType type, timestamp_t time, void * data, size_t len);
+
+/** Combine everybody's len bytes at data with op, leaving the result at root.
+ * Other processes' data is left partially combined. */
+void reduce(local_id root, MessageType type, timestamp_t time,
+            void * data, size_t len, ReduceOp op);
+
+/** reduce() to the parent, then broadcast() back: everybody ends with the result. */
+void allreduce(MessageType type, timestamp_t time, void * data, size_t len, ReduceOp op);
+
+/** allreduce() of count elements of size bytes each, for payloads of any size.
+ *
+ * A ring: reduce-scatter, then allgather, 2 (N-1) steps each moving 1/N
+ * of the data, so every process sends and receives about twice the data
+ * whatever N is.  op is applied to whole elements only.
+ */
+void ring_allreduce(MessageType type, timestamp_t time, void * data,
+                    size_t count, size_t size, ReduceOp op);
+
+/** Collect every process's parts, of up to GATHER_PART_MAX bytes, at root.
+ *
+ * Inner tree nodes forward their subtrees' parts as they come, so the root
+ * reads from log2 N processes instead of N - 1.  Forwarded parts keep their
+ * original timestamps.
+ *
+ * @param source  this process's parts, NULL if it contributes none
+ * @param sink    called at root only, for every part including its own
+ */
+void gather(local_id root, MessageType type, timestamp_t time,
+            GatherSource source, GatherSink sink);
+
+//------------------------------------------------------------------------------
+
+#endif // ITMO_HDU_DISTRIBUTED_SYSTEMS_IPC_H
@@ -0,0 +1,136 @@
+/**
+ * @file     message.h
+ * @Author   Michael Kosyakov, Evgeniy Ivanov and Denis Tarakanov (ifmo.distributedclass@gmail.com)
+ * @brief    Definitions of data structures and functions related to communication in system
+ *
+ * Students must not modify this file!
+ */
+
+#ifndef ITMO_HDU_DISTRIBUTED_SYSTEMS_MESSAGE_H
+#define ITMO_HDU_DISTRIBUTED_SYSTEMS_MESSAGE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+
+/** Highest child id accepted by -p.  Per-process state is sized at run time,
+ * so only libdistributedmodel has to be rebuilt with a different value. */
+#ifndef MODEL_MAX_PROCESS_ID
+#define MODEL_MAX_PROCESS_ID 1023
+#endif
+
+typedef int16_t local_id;
+
+/** Build everything with MODEL_WIDE defined (make WIDE=1) for 64-bit clocks
+ * and balances; libdistributedmodel and the labs must agree. */
+#ifdef MODEL_WIDE
+typedef int64_t timestamp_t;
+#define TIMESTAMP_MAX INT64_MAX
+#define PRI_TIME PRId64         ///< printf conversion for timestamp_t
+#else
+typedef int16_t timestamp_t;
+#define TIMESTAMP_MAX INT16_MAX
+#define PRI_TIME "d"
+#endif
+
+enum {
+    MESSAGE_MAGIC = 0xAFAF,
+    MAX_MESSAGE_LEN = 4096,
+    PARENT_ID = 0,
+    MAX_PROCESS_ID = MODEL_MAX_PROCESS_ID,
+    BUF_SIZE = 256
+};
+
+typedef enum {
+    STARTED = 0,     ///< message with string (doesn't include trailing '\0')
+    DONE,            ///< message with string (doesn't include trailing '\0')
+    ACK,             ///< empty message, or TransferAcks (see banking.h)
+    STOP,            ///< empty message
+    TRANSFER,        ///< message with a TransferOrder (see encode_orders())
+    BALANCE_HISTORY, ///< message with BalanceChanges (see encode_changes())
+    CS_REQUEST,      ///< empty message
+    CS_REPLY,        ///< empty message
+    CS_RELEASE,      ///< empty message
+    TRANSFER_BATCH   ///< message with TransferOrders sharing one s_src (see encode_orders())
+} MessageType;
+
+typedef struct {
+    uint16_t     s_magic;        ///< magic signature, must be MESSAGE_MAGIC
+    uint16_t     s_payload_len;  ///< length of payload
+    int16_t      s_type;         ///< type of the message
+    timestamp_t  s_local_time;   ///< set by sender, depends on particular lab
+} __attribute__((packed)) MessageHeader;
+
+enum {
+    MAX_PAYLOAD_LEN = MAX_MESSAGE_LEN - sizeof(MessageHeader)
+};
+
+typedef struct {
+    MessageHeader s_header;
+    char s_payload[MAX_PAYLOAD_LEN]; ///< Must be used as a buffer, unused "tail"
+                                     ///< shouldn't be transfered
+} __attribute__((packed)) Message;
+
+//------------------------------------------------------------------------------
+
+/** Helper function, automatically sets some Message fields.
+ *
+ * Should initialize message length, type, payload, magic and timestamp.
+ *
+ * @param msg       Message structure allocated by caller to be inited
+ * @parame type     Type of message
+ * @param time      Timestamp of message (0 for lab1, physical time for lab2 and Lamport's time for other).
+ * @param payload   Pointer to payload, which will be copied to message, can be NULL
+ * @param psize     Size of payload, can be 0 for empty payload (STOP message)
+ */
+void fill_message(Message * msg, MessageType type, timestamp_t time, void * payload, size_t psize);
+
+//------------------------------------------------------------------------------
+
+/** Send a message to the process specified by id.
+ *
+ * @param dst     ID of recepient
+ * @param msg     Message to send
+ *
+ * @return 0 on success, terminate model on errors
+ */
+int send(local_id dst, const Message * msg);
+
+//------------------------------------------------------------------------------
+
+/** Send multicast message.
+ *
+ * Send msg to all other processes including parent.
+ *
+ * @param msg     Message to multicast.
+ *
+ * @return 0 on success, terminate model on errors
+ */
+int send_multicast(const Message * msg);
+
+//------------------------------------------------------------------------------
+
+/** Receive a message from the process specified by id.
+ *
+ * @param from    ID of the process to receive message from
+ * @param msg     Message structure allocated by the caller
+ *
+ * @return 0 on success, terminate model on errors
+ */
+int receive(local_id from, Message * msg);
+
+//------------------------------------------------------------------------------
+
+/** Receive a message from any process.
+ *
+ * @param msg     Message structure allocated by the caller
+ *
+ * @return id of process, which message was received
+ */
+int receive_any(Message * msg);
+
+//------------------------------------------------------------------------------
+
+#endif // ITMO_HDU_DISTRIBUTED_SYSTEMS_MESSAGE_H
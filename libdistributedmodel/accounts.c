@@ -0,0 +1,73 @@
+#include <stdlib.h>
+
+#include "model.h"
+#include "banking.h"
+
+/*
+ * Open addressing with linear probing.  Keys and balances live in separate
+ * arrays, so a probe sequence walks consecutive keys only; the table doubles
+ * before it gets half full, which keeps those walks a couple of slots long.
+ */
+
+enum { MIN_CAPACITY = 16 };
+
+static uint32_t slot_of(const AccountTable *t, uint32_t id) {
+    /* Fibonacci hashing: the top bits of the product are well mixed */
+    return (uint32_t) (id * 2654435769u) >> t->shift;
+}
+
+static void alloc_slots(AccountTable *t, uint32_t capacity) {
+    t->keys = malloc(capacity * sizeof(*t->keys));
+    t->balances = calloc(capacity, sizeof(*t->balances));
+    if (!t->keys || !t->balances)
+        model_fatal("account table: out of memory");
+    for (uint32_t i = 0; i < capacity; ++i)
+        t->keys[i] = NO_ACCOUNT;
+    t->capacity = capacity;
+    t->shift = 32;
+    while ((1u << (32 - t->shift)) < capacity)
+        --t->shift;
+}
+
+static void grow(AccountTable *t) {
+    uint32_t *keys = t->keys;
+    balance_t *balances = t->balances;
+    uint32_t capacity = t->capacity;
+
+    alloc_slots(t, capacity ? 2 * capacity : MIN_CAPACITY);
+    for (uint32_t i = 0; i < capacity; ++i) {
+        if (keys[i] == NO_ACCOUNT)
+            continue;
+        uint32_t s = slot_of(t, keys[i]);
+        while (t->keys[s] != NO_ACCOUNT)
+            s = (s + 1) & (t->capacity - 1);
+        t->keys[s] = keys[i];
+        t->balances[s] = balances[i];
+    }
+    free(keys);
+    free(balances);
+}
+
+balance_t *account_balance(AccountTable *t, uint32_t id) {
+    if (id == NO_ACCOUNT)
+        model_fatal("account id %u is reserved", id);
+    if (2 * (t->count + 1) > t->capacity)
+        grow(t);
+
+    uint32_t s = slot_of(t, id);
+    while (t->keys[s] != id) {
+        if (t->keys[s] == NO_ACCOUNT) {
+            t->keys[s] = id;
+            ++t->count;
+            break;
+        }
+        s = (s + 1) & (t->capacity - 1);
+    }
+    return &t->balances[s];
+}
+
+void account_table_free(AccountTable *t) {
+    free(t->keys);
+    free(t->balances);
+    *t = (AccountTable) { 0 };
+}
@@ -0,0 +1,187 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "banking.h"
+
+/* ---------------- physical time ---------------- */
+/* The emulated clock lives in shared memory and advances each time the
+ * parent sends, so every process observes the same global order.  Long
+ * runs outlast timestamp_t, the clock then stays at its maximum. */
+void clock_tick(void) {
+    __atomic_add_fetch(&model_shared->clock, 1, __ATOMIC_SEQ_CST);
+}
+
+timestamp_t get_physical_time() {
+    int64_t t = __atomic_load_n(&model_shared->clock, __ATOMIC_SEQ_CST);
+    return t > TIMESTAMP_MAX ? TIMESTAMP_MAX : t;
+}
+
+timestamp_t get_physical_time_skew() {
+    timestamp_t t = get_physical_time();
+    if (t == TIMESTAMP_MAX)
+        return t;
+    t += model_self % 3 - 1;
+    return t < 0 ? 0 : t;
+}
+
+/* ---------------- print_history() ---------------- */
+enum { CELL_LEN = 32, LABEL_LEN = 12 };
+
+static void hline(int width) {
+    for (int i = 0; i < width; ++i)
+        putchar('-');
+    putchar('\n');
+}
+
+void print_history(const AllHistory *history) {
+    int nrows = history->s_history_len;
+    int ncols = 0;
+    bool pending = false;
+
+    for (int r = 0; r < nrows; ++r) {
+        const BalanceHistory *h = &history->s_history[r];
+        if (h->s_history_len > ncols)
+            ncols = h->s_history_len;
+        for (int t = 0; t < h->s_history_len; ++t) {
+            if (h->s_history[t].s_time > MAX_T)
+                model_fatal("print_history: max value of s_time: %" PRI_TIME ", expected s_time < %d!",
+                            h->s_history[t].s_time, MAX_T + 1);
+            if (h->s_history[t].s_balance_pending_in)
+                pending = true;
+        }
+    }
+    if (ncols == 0)
+        return;
+
+    /* Rows only record the ticks at which something changed: any slot whose
+     * s_time does not match its index carries the previous state forward. */
+    BalanceState *cells = calloc((size_t) (nrows + 1) * ncols, sizeof(*cells));
+    int *width = calloc(ncols, sizeof(*width));
+    if (!cells || !width)
+        model_fatal("print_history: out of memory");
+
+    BalanceState *total = &cells[nrows * ncols];
+    for (int r = 0; r < nrows; ++r) {
+        const BalanceHistory *h = &history->s_history[r];
+        BalanceState cur = {0, 0, 0};
+        for (int t = 0; t < ncols; ++t) {
+            if (t < h->s_history_len && (t == 0 || h->s_history[t].s_time == t))
+                cur = h->s_history[t];
+            cells[r * ncols + t] = cur;
+            total[t].s_balance += cur.s_balance;
+            total[t].s_balance_pending_in += cur.s_balance_pending_in;
+        }
+    }
+
+    char cell[CELL_LEN];
+    for (int t = 0; t < ncols; ++t) {
+        width[t] = snprintf(cell, sizeof(cell), "%d", t);
+        for (int r = 0; r <= nrows; ++r) {
+            const BalanceState *s = &cells[r * ncols + t];
+            int w = pending
+                ? snprintf(cell, sizeof(cell), "%" PRI_BALANCE " (%" PRI_BALANCE ")",
+                           s->s_balance, s->s_balance_pending_in)
+                : snprintf(cell, sizeof(cell), "%" PRI_BALANCE, s->s_balance);
+            if (w > width[t])
+                width[t] = w;
+        }
+    }
+
+    int line = LABEL_LEN;
+    for (int t = 0; t < ncols; ++t)
+        line += width[t] + 3;
+
+    printf(pending
+           ? "\nFull balance history for time range [0;%d], $balance ($pending):\n"
+           : "\nFull balance history for time range [0;%d], $balance:\n",
+           ncols - 1);
+    hline(line);
+    printf("Proc \\ time |");
+    for (int t = 0; t < ncols; ++t)
+        printf(" %*d |", width[t], t);
+    putchar('\n');
+    hline(line);
+
+    for (int r = 0; r <= nrows; ++r) {
+        if (r < nrows)
+            printf("%11d |", history->s_history[r].s_id);
+        else
+            printf("%11s |", "Total");
+        for (int t = 0; t < ncols; ++t) {
+            const BalanceState *s = &cells[r * ncols + t];
+            if (pending)
+                snprintf(cell, sizeof(cell), "%" PRI_BALANCE " (%" PRI_BALANCE ")",
+                           s->s_balance, s->s_balance_pending_in);
+            else
+                snprintf(cell, sizeof(cell), "%" PRI_BALANCE, s->s_balance);
+            printf(" %*s |", width[t], cell);
+        }
+        putchar('\n');
+        hline(line);
+    }
+    fflush(stdout);
+
+    free(cells);
+    free(width);
+}
+
+/* ---------------- check_history() ---------------- */
+/* Column sums run on GCC vector extensions, which stay SIMD without -O. */
+enum { LANES = 4 };
+typedef int64_t lanes_t __attribute__((vector_size(LANES * sizeof(int64_t))));
+
+/* One child as a column of balance plus pending, carrying states forward
+ * like print_history() does. */
+static void column(const BalanceHistory *h, int ncols, int64_t *money) {
+    BalanceState cur = {0, 0, 0};
+    for (int t = 0; t < ncols; ++t) {
+        if (t < h->s_history_len && (t == 0 || h->s_history[t].s_time == t))
+            cur = h->s_history[t];
+        money[t] = (int64_t) cur.s_balance + cur.s_balance_pending_in;
+    }
+}
+
+timestamp_t check_history(const AllHistory *history) {
+    int ncols = 0;
+    for (int r = 0; r < history->s_history_len; ++r)
+        if (history->s_history[r].s_history_len > ncols)
+            ncols = history->s_history[r].s_history_len;
+    if (ncols == 0)
+        return -1;
+
+    /* two columns: the running total and the child being added */
+    int nvec = (ncols + LANES - 1) / LANES;
+    lanes_t *total;
+    if (posix_memalign((void **) &total, sizeof(*total), 2 * nvec * sizeof(*total)))
+        model_fatal("check_history: out of memory");
+    memset(total, 0, 2 * nvec * sizeof(*total));
+    lanes_t *money = total + nvec;
+
+    for (int r = 0; r < history->s_history_len; ++r) {
+        column(&history->s_history[r], ncols, (int64_t *) money);
+        for (int v = 0; v < nvec; ++v)
+            total[v] += money[v];
+    }
+
+    /* the padding of the last vector holds zeros, it does not count */
+    lanes_t want = {0};
+    want += ((int64_t *) total)[0];
+    timestamp_t bad = -1;
+    for (int v = 0; v < nvec && bad < 0; ++v) {
+        lanes_t differs = total[v] != want;
+        if (!(differs[0] | differs[1] | differs[2] | differs[3]))
+            continue;
+        for (int i = 0; i < LANES; ++i) {
+            if (differs[i] && v * LANES + i < ncols) {
+                bad = v * LANES + i;
+                break;
+            }
+        }
+    }
+    free(total);
+    return bad;
+}
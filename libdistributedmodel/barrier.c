@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "ipc.h"
+
+/*
+ * barrier() picks its algorithm once, by $DISTRIBUTED_MODEL_BARRIER:
+ *
+ *   all-to-all      every child multicasts, everybody waits for every
+ *                   child: (N-1)^2 messages, what the labs are specified
+ *                   with and the default
+ *   tree            children report up a FAN_IN-ary tree rooted at the
+ *                   parent, which releases them back down: 2(N-1) messages
+ *   dissemination   in round k everybody signals the process 2^k ahead
+ *                   and waits for the one 2^k behind: N ceil(log2 N)
+ *                   messages, no process waits for more than one at a time
+ *
+ * Every message carries the latest time its sender knows of, so all three
+ * end with the latest time any process entered with.  Barrier messages
+ * have the type of the phase and are taken with receive_type_view(), so
+ * anything else that arrives meanwhile waits in its mailbox.
+ */
+
+enum { FAN_IN = 4 };
+
+struct algorithm {
+    const char *name;
+    timestamp_t (*run)(MessageType phase, timestamp_t time);
+};
+
+/* the caller's payload, sent with every message of this process */
+static struct iovec payload;
+static int npayload;
+
+static timestamp_t later(timestamp_t a, timestamp_t b) {
+    return a > b ? a : b;
+}
+
+static void notify(local_id dst, MessageType phase, timestamp_t time) {
+    send_iov(dst, phase, time, &payload, npayload);
+}
+
+static timestamp_t await(local_id from, MessageType phase, timestamp_t time) {
+    const Message *msg = receive_type_view(from, phase);
+    time = later(time, msg->s_header.s_local_time);
+    release_view(msg);
+    return time;
+}
+
+/* The parent only listens, as in the labs' STARTED and DONE phases. */
+static timestamp_t all_to_all(MessageType phase, timestamp_t time) {
+    if (model_self != PARENT_ID)
+        send_multicast_iov(phase, time, &payload, npayload);
+    for (local_id i = 1; i < model_nprocs; ++i) {
+        if (i != model_self)
+            time = await(i, phase, time);
+    }
+    return time;
+}
+
+static timestamp_t tree(MessageType phase, timestamp_t time) {
+    local_id first = FAN_IN * model_self + 1;
+    local_id last = first + FAN_IN < model_nprocs ? first + FAN_IN : model_nprocs;
+
+    for (local_id c = first; c < last; ++c)
+        time = await(c, phase, time);
+    if (model_self != PARENT_ID) {
+        local_id up = (model_self - 1) / FAN_IN;
+        notify(up, phase, time);
+        time = await(up, phase, time);
+    }
+    for (local_id c = first; c < last; ++c)
+        notify(c, phase, time);
+    return time;
+}
+
+static timestamp_t dissemination(MessageType phase, timestamp_t time) {
+    int n = model_nprocs;
+    for (int d = 1; d < n; d *= 2) {
+        notify((model_self + d) % n, phase, time);
+        time = await((model_self - d + n) % n, phase, time);
+    }
+    return time;
+}
+
+static const struct algorithm algorithms[] = {
+    { "all-to-all", all_to_all },
+    { "tree", tree },
+    { "dissemination", dissemination },
+};
+
+static const struct algorithm *algorithm = NULL;
+
+static const struct algorithm *pick(void) {
+    const char *name = getenv("DISTRIBUTED_MODEL_BARRIER");
+    if (!name)
+        return &algorithms[0];
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(*algorithms); ++i) {
+        if (strcmp(name, algorithms[i].name) == 0)
+            return &algorithms[i];
+    }
+    model_fatal("Unknown barrier: %s", name);
+}
+
+timestamp_t barrier(MessageType phase, timestamp_t time, const void *data, size_t len) {
+    if (!algorithm)
+        algorithm = pick();
+    payload = (struct iovec) { (void *) data, len };
+    npayload = len ? 1 : 0;
+    return algorithm->run(phase, time);
+}
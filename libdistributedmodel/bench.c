@@ -0,0 +1,238 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "message.h"
+#include "ipc.h"
+#include "process.h"
+
+/*
+ * Microbenchmarks of the message.h layer, run as a lab 1 model:
+ *
+ *   BENCH_TEST=pingpong|stream|multicast BENCH_SIZE=<payload bytes>
+ *   BENCH_ITERS=<count> ./transport_bench -l 1 -p <children>
+ *
+ * pingpong   child 1 <-> child 2 round trips, percentiles of the round trip
+ * stream     child 1 -> child 2 back to back, percentiles of the gaps
+ *            between arrivals
+ * multicast  child 1 send_multicast()s, everybody else answers with an
+ *            empty ACK; percentiles of the whole round plus of the
+ *            send_multicast() call alone
+ * barrier    everybody calls barrier() back to back with the algorithm
+ *            of $DISTRIBUTED_MODEL_BARRIER; percentiles of one barrier
+ *            as child 1 sees it
+ *
+ * The measuring process prints one JSON object per run on stdout; bench.sh
+ * runs the usual matrix.
+ */
+
+enum { WARMUP = 100 };
+
+static const char *test;
+static size_t size;
+static long iters;
+static char payload[MAX_PAYLOAD_LEN];
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted samples. */
+static uint64_t percentile(const uint64_t *v, long n, double q) {
+    long rank = (long) (q * n + 0.999999);
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_stats(const char *prefix, uint64_t *v, long n) {
+    qsort(v, n, sizeof(*v), cmp_u64);
+    printf(", \"%sp50_ns\": %llu, \"%sp99_ns\": %llu, \"%sp999_ns\": %llu",
+           prefix, (unsigned long long) percentile(v, n, 0.50),
+           prefix, (unsigned long long) percentile(v, n, 0.99),
+           prefix, (unsigned long long) percentile(v, n, 0.999));
+}
+
+static void report(int nprocs, uint64_t *v, uint64_t *send_v, double msgs,
+                   uint64_t elapsed) {
+    const char *transport = getenv("DISTRIBUTED_MODEL_TRANSPORT");
+    printf("{\"test\": \"%s\", \"transport\": \"%s\", \"nprocs\": %d, "
+           "\"size\": %zu, \"iters\": %ld",
+           test, transport ? transport : "pipe", nprocs, size, iters);
+    if (strcmp(test, "barrier") == 0) {
+        const char *algorithm = getenv("DISTRIBUTED_MODEL_BARRIER");
+        printf(", \"barrier\": \"%s\"", algorithm ? algorithm : "all-to-all");
+    }
+    print_stats("", v, iters);
+    if (send_v)
+        print_stats("send_", send_v, iters);
+    printf(", \"msgs_per_sec\": %.0f}\n", msgs * 1e9 / elapsed);
+    fflush(stdout);
+}
+
+static uint64_t *samples(void) {
+    uint64_t *v = malloc(sizeof(*v) * iters);
+    if (!v) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
+
+/* ---------------- tests ---------------- */
+static void send_payload(local_id dst, MessageType type, long i) {
+    struct iovec v = { payload, size };
+    send_iov(dst, type, (timestamp_t) i, &v, size ? 1 : 0);
+}
+
+static void pingpong(local_id self, int nprocs) {
+    Message msg;
+    if (self == 2) {
+        for (long i = 0; i < WARMUP + iters; ++i) {
+            receive(1, &msg);
+            send_payload(1, ACK, i);
+        }
+    } else if (self == 1) {
+        uint64_t *v = samples();
+        uint64_t start = 0;
+        for (long i = -WARMUP; i < iters; ++i) {
+            if (i == 0)
+                start = now_ns();
+            uint64_t t = now_ns();
+            send_payload(2, TRANSFER, i);
+            receive(2, &msg);
+            if (i >= 0)
+                v[i] = now_ns() - t;
+        }
+        report(nprocs, v, NULL, 2.0 * iters, now_ns() - start);
+        free(v);
+    }
+}
+
+static void stream(local_id self, int nprocs) {
+    if (self == 1) {
+        for (long i = 0; i < WARMUP + iters; ++i)
+            send_payload(2, TRANSFER, i);
+    } else if (self == 2) {
+        uint64_t *v = samples();
+        uint64_t start = 0, last = 0;
+        for (long i = -WARMUP; i < iters; ++i) {
+            release_view(receive_view(1));
+            uint64_t t = now_ns();
+            if (i == 0)
+                start = t;
+            if (i >= 0)
+                v[i] = t - last;
+            last = t;
+        }
+        report(nprocs, v, NULL, iters, last - start);
+        free(v);
+    }
+}
+
+static void multicast(local_id self, int nprocs) {
+    if (self != 1) {
+        for (long i = 0; i < WARMUP + iters; ++i) {
+            release_view(receive_view(1));
+            send_iov(1, ACK, 0, NULL, 0);
+        }
+        return;
+    }
+
+    uint64_t *v = samples(), *send_v = samples();
+    uint64_t start = 0;
+    struct iovec iov = { payload, size };
+    for (long i = -WARMUP; i < iters; ++i) {
+        if (i == 0)
+            start = now_ns();
+        uint64_t t = now_ns();
+        send_multicast_iov(TRANSFER, (timestamp_t) i, &iov, size ? 1 : 0);
+        uint64_t sent = now_ns();
+        for (int n = 1; n < nprocs; ++n)
+            release_view(receive_any_view(NULL));
+        if (i >= 0) {
+            v[i] = now_ns() - t;
+            send_v[i] = sent - t;
+        }
+    }
+    report(nprocs, v, send_v, (double) (nprocs - 1) * iters, now_ns() - start);
+    free(v);
+    free(send_v);
+}
+
+/* Messages one barrier takes, see barrier.c. */
+static double barrier_messages(int nprocs) {
+    const char *algorithm = getenv("DISTRIBUTED_MODEL_BARRIER");
+    if (algorithm && strcmp(algorithm, "tree") == 0)
+        return 2.0 * (nprocs - 1);
+    if (algorithm && strcmp(algorithm, "dissemination") == 0) {
+        int rounds = 0;
+        for (int d = 1; d < nprocs; d *= 2)
+            ++rounds;
+        return (double) nprocs * rounds;
+    }
+    return (double) (nprocs - 1) * (nprocs - 1);
+}
+
+static void barriers(local_id self, int nprocs) {
+    uint64_t *v = self == 1 ? samples() : NULL;
+    uint64_t start = 0;
+    for (long i = -WARMUP; i < iters; ++i) {
+        if (i == 0)
+            start = now_ns();
+        uint64_t t = now_ns();
+        barrier(TRANSFER, (timestamp_t) i, payload, size);
+        if (v && i >= 0)
+            v[i] = now_ns() - t;
+    }
+    if (v) {
+        report(nprocs, v, NULL, barrier_messages(nprocs) * iters, now_ns() - start);
+        free(v);
+    }
+}
+
+static void run(local_id self, int nprocs) {
+    test = getenv("BENCH_TEST") ? getenv("BENCH_TEST") : "pingpong";
+    size = getenv("BENCH_SIZE") ? strtoul(getenv("BENCH_SIZE"), NULL, 10) : 0;
+    iters = getenv("BENCH_ITERS") ? strtol(getenv("BENCH_ITERS"), NULL, 10) : 10000;
+    if (size > MAX_PAYLOAD_LEN || iters < 1) {
+        fprintf(stderr, "BENCH_SIZE must be at most %d, BENCH_ITERS positive\n",
+                MAX_PAYLOAD_LEN);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(test, "multicast") == 0) {
+        multicast(self, nprocs);
+    } else if (strcmp(test, "barrier") == 0) {
+        barriers(self, nprocs);
+    } else if (nprocs < 3) {
+        fprintf(stderr, "%s needs at least 2 children\n", test);
+        exit(EXIT_FAILURE);
+    } else if (strcmp(test, "pingpong") == 0) {
+        pingpong(self, nprocs);
+    } else if (strcmp(test, "stream") == 0) {
+        stream(self, nprocs);
+    } else {
+        fprintf(stderr, "Unknown BENCH_TEST: %s\n", test);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* ---------------- model entry points ---------------- */
+void parent_work(int count_nodes) {
+    run(PARENT_ID, count_nodes);
+}
+
+void child_work(struct child_arguments args) {
+    run(args.self_id, args.count_nodes);
+}
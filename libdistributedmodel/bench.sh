@@ -0,0 +1,53 @@
+#!/bin/sh
+# Runs the transport microbenchmarks and prints one JSON object per line.
+#
+#   BENCH_TRANSPORTS   transports to compare (default: "pipe shm")
+#   BENCH_NPROCS       process counts for the multicast fan-out and the
+#                      barriers (default: "2 4 8 16 32 64")
+#   BENCH_BARRIERS     barrier algorithms to compare
+#                      (default: "all-to-all tree dissemination")
+#   BENCH_ITERS        iterations per run (default: 20000, multicast and
+#                      barrier 2000)
+
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+bench="$here/transport_bench"
+transports=${BENCH_TRANSPORTS:-pipe shm}
+nprocs=${BENCH_NPROCS:-2 4 8 16 32 64}
+barriers=${BENCH_BARRIERS:-all-to-all tree dissemination}
+
+# events.log lands in the working directory
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+export LD_LIBRARY_PATH="$here${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+
+run() {     # test size children iters
+    BENCH_TEST=$1 BENCH_SIZE=$2 BENCH_ITERS=$4 "$bench" -l 1 -p "$3"
+}
+
+# 0 B, TransferOrder, BalanceHistory, the largest payload
+sizes="0 6 1539 4088"
+
+for t in $transports; do
+    export DISTRIBUTED_MODEL_TRANSPORT=$t
+    for s in $sizes; do
+        run pingpong "$s" 2 "${BENCH_ITERS:-20000}"
+    done
+    for s in $sizes; do
+        run stream "$s" 2 "${BENCH_ITERS:-20000}"
+    done
+    for n in $nprocs; do
+        for s in 0 4088; do
+            run multicast "$s" $((n - 1)) "${BENCH_ITERS:-2000}"
+        done
+    done
+    for b in $barriers; do
+        export DISTRIBUTED_MODEL_BARRIER=$b
+        for n in $nprocs; do
+            run barrier 0 $((n - 1)) "${BENCH_ITERS:-2000}"
+        done
+    done
+    unset DISTRIBUTED_MODEL_BARRIER
+done
@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "ipc.h"
+
+/*
+ * Collectives over all processes, parent included, on send_iov() and
+ * receive_type_view().  Broadcast, reduce and gather follow a binomial
+ * tree rooted at `root`: with ranks counted from the root, rank r hangs
+ * below r minus its lowest set bit, so every process talks to at most
+ * log2 N others and the depth is ceil(log2 N).  The ring allreduce moves
+ * 2 (N-1)/N of the data through every process whatever N is, which wins
+ * once payloads no longer fit one message.
+ */
+
+static int rank_of(local_id id, local_id root) {
+    return (id - root + model_nprocs) % model_nprocs;
+}
+
+static local_id id_of(int rank, local_id root) {
+    return (rank + root) % model_nprocs;
+}
+
+/* Lowest set bit of rank, or the first power of two >= N at the root:
+ * the children of rank r are r + m for every power of two m below it. */
+static int subtree(int rank) {
+    int mask = 1;
+    while (mask < model_nprocs && !(rank & mask))
+        mask <<= 1;
+    return mask;
+}
+
+static void send_bytes(local_id dst, MessageType type, timestamp_t time,
+                       const void *data, size_t len) {
+    struct iovec v = { (void *) data, len };
+    send_iov(dst, type, time, &v, len ? 1 : 0);
+}
+
+/* Receives exactly len bytes from one message of type from `from`. */
+static void receive_bytes(local_id from, MessageType type, void *data, size_t len) {
+    const Message *msg = receive_type_view(from, type);
+    if (msg->s_header.s_payload_len != len)
+        model_fatal("Process %d expected %zu bytes from %d, got %d",
+                    model_self, len, from, msg->s_header.s_payload_len);
+    memcpy(data, msg->s_payload, len);
+    release_view(msg);
+}
+
+static void check_fits(const char *what, size_t len) {
+    if (len > MAX_PAYLOAD_LEN)
+        model_fatal("%s: %zu bytes do not fit one message", what, len);
+}
+
+/* ---------------- broadcast, reduce, allreduce ---------------- */
+void broadcast(local_id root, MessageType type, timestamp_t time, void *data, size_t len) {
+    check_fits("broadcast", len);
+    int r = rank_of(model_self, root);
+    int mask = subtree(r);
+    if (r)
+        receive_bytes(id_of(r - mask, root), type, data, len);
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+        if (r + mask < model_nprocs)
+            send_bytes(id_of(r + mask, root), type, time, data, len);
+    }
+}
+
+void reduce(local_id root, MessageType type, timestamp_t time, void *data, size_t len, ReduceOp op) {
+    check_fits("reduce", len);
+    char in[MAX_PAYLOAD_LEN];
+    int r = rank_of(model_self, root);
+    int mask = 1;
+    for (; mask < model_nprocs && !(r & mask); mask <<= 1) {
+        if (r + mask < model_nprocs) {
+            receive_bytes(id_of(r + mask, root), type, in, len);
+            op(data, in, len);
+        }
+    }
+    if (r)
+        send_bytes(id_of(r - mask, root), type, time, data, len);
+}
+
+void allreduce(MessageType type, timestamp_t time, void *data, size_t len, ReduceOp op) {
+    reduce(PARENT_ID, type, time, data, len, op);
+    broadcast(PARENT_ID, type, time, data, len);
+}
+
+/* ---------------- ring allreduce ---------------- */
+/* Chunk i of count elements, the one process i ends up owning. */
+static size_t chunk_start(int i, size_t count) {
+    return count / model_nprocs * i + ((size_t) i < count % model_nprocs ? i : count % model_nprocs);
+}
+
+/* One chunk to the right while one comes from the left, a message at a
+ * time: every process sends first, so a chunk larger than a channel
+ * holds would otherwise block the whole ring. */
+static void ring_step(MessageType type, timestamp_t time, char *data, size_t size,
+                      int send, int recv, size_t count, ReduceOp op) {
+    local_id right = (model_self + 1) % model_nprocs, left = (model_self + model_nprocs - 1) % model_nprocs;
+    size_t per_msg = MAX_PAYLOAD_LEN / size * size;
+    char *out = data + chunk_start(send, count) * size;
+    size_t out_len = (chunk_start(send + 1, count) - chunk_start(send, count)) * size;
+    char *in = data + chunk_start(recv, count) * size;
+    size_t in_len = (chunk_start(recv + 1, count) - chunk_start(recv, count)) * size;
+    char buf[MAX_PAYLOAD_LEN];
+
+    while (out_len || in_len) {
+        size_t n = out_len < per_msg ? out_len : per_msg;
+        if (n) {
+            send_bytes(right, type, time, out, n);
+            out += n;
+            out_len -= n;
+        }
+        n = in_len < per_msg ? in_len : per_msg;
+        if (n) {
+            if (op) {
+                receive_bytes(left, type, buf, n);
+                op(in, buf, n);
+            } else {
+                receive_bytes(left, type, in, n);
+            }
+            in += n;
+            in_len -= n;
+        }
+    }
+}
+
+void ring_allreduce(MessageType type, timestamp_t time, void *data, size_t count,
+                    size_t size, ReduceOp op) {
+    int n = model_nprocs, r = model_self;
+    if (!size || size > MAX_PAYLOAD_LEN)
+        model_fatal("ring_allreduce: elements of %zu bytes", size);
+
+    /* reduce-scatter: after n - 1 steps process r owns the sum of chunk r + 1 */
+    for (int s = 0; s < n - 1; ++s)
+        ring_step(type, time, data, size, (r - s + n) % n, (r - s - 1 + 2 * n) % n, count, op);
+    /* allgather: pass the finished chunks around */
+    for (int s = 0; s < n - 1; ++s)
+        ring_step(type, time, data, size, (r + 1 - s + n) % n, (r - s + n) % n, count, NULL);
+}
+
+/* ---------------- gather ---------------- */
+/* Every part travels with the id of the process it comes from; a part
+ * with no data from the sender itself closes the sender's subtree. */
+enum { ORIGIN_LEN = sizeof(local_id) };
+
+static void send_part(local_id dst, MessageType type, timestamp_t time, local_id origin,
+                      const void *part, size_t len) {
+    struct iovec v[2] = { { &origin, ORIGIN_LEN }, { (void *) part, len } };
+    send_iov(dst, type, time, v, len ? 2 : 1);
+}
+
+void gather(local_id root, MessageType type, timestamp_t time,
+            GatherSource source, GatherSink sink) {
+    int r = rank_of(model_self, root);
+    int mask = subtree(r);
+    local_id up = r ? id_of(r - mask, root) : -1;
+    char part[GATHER_PART_MAX];
+    size_t len;
+
+    /* our own parts first, then each subtree as it arrives */
+    while (source && (len = source(part, sizeof(part)))) {
+        if (len > sizeof(part))
+            model_fatal("gather: part of %zu bytes", len);
+        if (r)
+            send_part(up, type, time, model_self, part, len);
+        else
+            sink(model_self, part, len);
+    }
+    for (int m = 1; m < mask && r + m < model_nprocs; m <<= 1) {
+        local_id child = id_of(r + m, root);
+        for (;;) {
+            const Message *msg = receive_type_view(child, type);
+            size_t n = msg->s_header.s_payload_len;
+            local_id origin;
+            if (n < ORIGIN_LEN)
+                model_fatal("gather: message of %zu bytes from %d", n, child);
+            memcpy(&origin, msg->s_payload, ORIGIN_LEN);
+            bool closed = n == ORIGIN_LEN && origin == child;
+            if (!closed && r)   /* forwarded from the channel buffer as it is */
+                send_part(up, type, msg->s_header.s_local_time, origin,
+                          msg->s_payload + ORIGIN_LEN, n - ORIGIN_LEN);
+            else if (!closed)
+                sink(origin, msg->s_payload + ORIGIN_LEN, n - ORIGIN_LEN);
+            release_view(msg);
+            if (closed)
+                break;
+        }
+    }
+    if (r)
+        send_part(up, type, time, model_self, NULL, 0);
+}
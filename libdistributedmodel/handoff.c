@@ -0,0 +1,109 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "handoff.h"
+
+/*
+ * Every process listens on an abstract-namespace unix socket named after
+ * the model's parent and its own id.  A handoff is a one-shot connection
+ * carrying the sender's id and, through SCM_RIGHTS, at most one descriptor.
+ */
+
+typedef int16_t handoff_id;     ///< same width as local_id
+
+union control {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+};
+
+static socklen_t address(long owner, int id, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                     "distributed-model/%ld/%d", owner, id);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+int handoff_listen(long owner, int id, int backlog) {
+    struct sockaddr_un addr;
+    socklen_t len = address(owner, id, &addr);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0)
+        return -1;
+    if (bind(fd, (struct sockaddr *) &addr, len) < 0 || listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool handoff_send(long owner, int dst, int self, int fd) {
+    struct sockaddr_un addr;
+    socklen_t len = address(owner, dst, &addr);
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    int r;
+
+    if (s < 0)
+        return false;
+    while ((r = connect(s, (struct sockaddr *) &addr, len)) < 0 && errno == EINTR)
+        ;
+    if (r == 0) {
+        handoff_id id = self;
+        union control ctl;
+        struct iovec v = { &id, sizeof(id) };
+        struct msghdr mh = { .msg_iov = &v, .msg_iovlen = 1 };
+        if (fd >= 0) {
+            mh.msg_control = ctl.buf;
+            mh.msg_controllen = sizeof(ctl.buf);
+            struct cmsghdr *c = CMSG_FIRSTHDR(&mh);
+            c->cmsg_level = SOL_SOCKET;
+            c->cmsg_type = SCM_RIGHTS;
+            c->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(c), &fd, sizeof(int));
+        }
+        while ((r = sendmsg(s, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+            ;
+    }
+    close(s);
+    return r >= 0;
+}
+
+int handoff_accept(int listener, int *from, int *fd) {
+    int s;
+    while ((s = accept(listener, NULL, NULL)) < 0 && errno == EINTR)
+        ;
+    if (s < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+
+    /* the sender writes right after connect(), so this does not wait long */
+    handoff_id id = -1;
+    union control ctl;
+    struct iovec v = { &id, sizeof(id) };
+    struct msghdr mh = {
+        .msg_iov = &v, .msg_iovlen = 1,
+        .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf)
+    };
+    ssize_t n;
+    while ((n = recvmsg(s, &mh, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    close(s);
+    if (n != sizeof(id))
+        return -1;
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&mh);
+    *from = id;
+    *fd = -1;
+    if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS)
+        memcpy(fd, CMSG_DATA(c), sizeof(int));
+    return 1;
+}
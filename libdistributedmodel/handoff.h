@@ -0,0 +1,27 @@
+/**
+ * @file     handoff.h
+ * @brief    Passing pipe ends between the processes of the model
+ *
+ * Kept apart from model.h: <sys/socket.h> declares a send() of its own, so
+ * handoff.c cannot see message.h and the interface sticks to plain ints.
+ */
+
+#ifndef DISTRIBUTED_MODEL_HANDOFF_H
+#define DISTRIBUTED_MODEL_HANDOFF_H
+
+#include <stdbool.h>
+
+/** Creates the listening socket of process id; -1 on errors.
+ *  owner tells concurrent models apart. */
+int handoff_listen(long owner, int id, int backlog);
+
+/** Connects to the listener of dst and passes fd along with self, or only
+ *  self if fd is -1.  Returns false if dst is not listening any more. */
+bool handoff_send(long owner, int dst, int self, int fd);
+
+/** Takes one pending connection off the non-blocking listener.  Returns 1
+ *  and the sender's id and passed fd (-1 if none), 0 if nothing is pending
+ *  and -1 on errors. */
+int handoff_accept(int listener, int *from, int *fd);
+
+#endif // DISTRIBUTED_MODEL_HANDOFF_H
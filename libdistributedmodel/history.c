@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "banking.h"
+
+/*
+ * Change points are kept sorted by time.  Labs change the present or a
+ * recent past, so points are found from the end and insertions move only
+ * a few points; a lookup far back is a binary search.
+ *
+ * Pending ranges reach back to the send time of a transfer, and many of
+ * them overlap.  They go to a difference array instead, +amount at the
+ * start and -amount at the end, which changes_fold() sorts and sums into
+ * the points once the history is complete.
+ */
+
+enum { MIN_POINTS = 16 };
+
+void changes_reserve(BalanceChanges *c, uint32_t n) {
+    if (n <= c->s_cap)
+        return;
+    uint32_t cap = c->s_cap ? c->s_cap : MIN_POINTS;
+    while (cap < n)
+        cap = cap > UINT32_MAX / 2 ? UINT32_MAX : 2 * cap;
+    BalanceState *p = realloc(c->s_points, (size_t) cap * sizeof(*p));
+    if (!p)
+        model_fatal("balance changes: out of memory");
+    c->s_points = p;
+    c->s_cap = cap;
+}
+
+/* Index of the last point with s_time <= t, -1 if there is none. */
+static int64_t find(const BalanceChanges *c, timestamp_t t) {
+    int64_t lo = 0, hi = c->s_len;
+    if (hi > 0 && c->s_points[hi - 1].s_time <= t)
+        return hi - 1;
+    while (lo < hi) {
+        int64_t mid = lo + (hi - lo) / 2;
+        if (c->s_points[mid].s_time <= t)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - 1;
+}
+
+/* Index of the point at exactly t, inserted as a copy of the state then. */
+static uint32_t split(BalanceChanges *c, timestamp_t t) {
+    int64_t i = find(c, t);
+    if (i >= 0 && c->s_points[i].s_time == t)
+        return i;
+
+    changes_reserve(c, c->s_len + 1);
+    uint32_t at = i + 1;
+    memmove(&c->s_points[at + 1], &c->s_points[at], (c->s_len - at) * sizeof(*c->s_points));
+    ++c->s_len;
+    c->s_points[at] = i >= 0 ? c->s_points[i] : (BalanceState) { 0, 0, 0 };
+    c->s_points[at].s_time = t;
+    return at;
+}
+
+void changes_set_balance(BalanceChanges *c, timestamp_t t, balance_t balance) {
+    for (uint32_t i = split(c, t); i < c->s_len; ++i)
+        c->s_points[i].s_balance = balance;
+    if (t >= c->s_end)
+        c->s_end = t < TIMESTAMP_MAX ? t + 1 : t;
+}
+
+void changes_add_pending(BalanceChanges *c, timestamp_t from, timestamp_t to, balance_t amount) {
+    if (from >= to)
+        return;
+    if (c->s_deltas_cap - c->s_deltas_len < 2) {
+        uint32_t cap = c->s_deltas_cap ? 2 * c->s_deltas_cap : MIN_POINTS;
+        PendingDelta *d;
+        if (cap < c->s_deltas_cap || !(d = realloc(c->s_deltas, (size_t) cap * sizeof(*d))))
+            model_fatal("balance changes: out of memory");
+        c->s_deltas = d;
+        c->s_deltas_cap = cap;
+    }
+    c->s_deltas[c->s_deltas_len++] = (PendingDelta) { from, amount };
+    c->s_deltas[c->s_deltas_len++] = (PendingDelta) { to, -amount };
+    if (to > c->s_end)
+        c->s_end = to;
+}
+
+static int delta_by_time(const void *a, const void *b) {
+    timestamp_t x = ((const PendingDelta *) a)->s_time, y = ((const PendingDelta *) b)->s_time;
+    return (x > y) - (x < y);
+}
+
+void changes_fold(BalanceChanges *c) {
+    uint32_t n = c->s_deltas_len;
+    if (!n)
+        return;
+    if (c->s_len > UINT32_MAX - n)
+        model_fatal("balance changes: too many points");
+    qsort(c->s_deltas, n, sizeof(*c->s_deltas), delta_by_time);
+
+    const BalanceState *p = c->s_points;
+    const PendingDelta *d = c->s_deltas;
+    uint32_t cap = c->s_len + n;
+    BalanceState *out = malloc((size_t) cap * sizeof(*out));
+    if (!out)
+        model_fatal("balance changes: out of memory");
+
+    /* walk both by time, a point comes wherever either of them steps */
+    BalanceState cur = { 0, 0, 0 };
+    balance_t pending = 0;
+    uint32_t i = 0, j = 0, k = 0;
+    while (i < c->s_len || j < n) {
+        timestamp_t t = j == n || (i < c->s_len && p[i].s_time <= d[j].s_time)
+                        ? p[i].s_time : d[j].s_time;
+        while (i < c->s_len && p[i].s_time == t)
+            cur = p[i++];
+        while (j < n && d[j].s_time == t)
+            pending += d[j++].s_amount;
+
+        BalanceState s = { cur.s_balance, t, cur.s_balance_pending_in + pending };
+        if (k > 0 && s.s_balance == out[k - 1].s_balance
+                  && s.s_balance_pending_in == out[k - 1].s_balance_pending_in)
+            continue;
+        out[k++] = s;
+    }
+
+    free(c->s_points);
+    c->s_points = out;
+    c->s_len = k;
+    c->s_cap = cap;
+    c->s_deltas_len = 0;
+}
+
+void changes_expand(BalanceChanges *c, BalanceHistory *h) {
+    timestamp_t len = c->s_end < UINT8_MAX ? c->s_end : UINT8_MAX;
+    BalanceState cur = { 0, 0, 0 };
+    uint32_t i = 0;
+
+    changes_fold(c);
+    h->s_id = c->s_id;
+    h->s_history_len = len;
+    for (timestamp_t t = 0; t < len; ++t) {
+        while (i < c->s_len && c->s_points[i].s_time <= t)
+            cur = c->s_points[i++];
+        h->s_history[t] = cur;
+        h->s_history[t].s_time = t;
+    }
+}
+
+void changes_free(BalanceChanges *c) {
+    free(c->s_points);
+    free(c->s_deltas);
+    *c = (BalanceChanges) { 0 };
+}
+
+/* ---------------- queries ---------------- */
+/* State at time t, all zero before the first point. */
+static BalanceState state_at(const BalanceChanges *c, timestamp_t t) {
+    int64_t i = find(c, t);
+    return i >= 0 ? c->s_points[i] : (BalanceState) { 0, 0, 0 };
+}
+
+/* What one point of one child changes in the sums. */
+struct delta {
+    timestamp_t time;
+    balance_t balance, pending;
+};
+
+static int by_time(const void *a, const void *b) {
+    timestamp_t x = ((const struct delta *) a)->time, y = ((const struct delta *) b)->time;
+    return (x > y) - (x < y);
+}
+
+/* The sums only change where some child's state does: sort the changes of
+ * all children by time and add them up. */
+static void build_total(HistoryIndex *x) {
+    size_t n = 0;
+    for (int i = 0; i < x->s_children; ++i)
+        n += x->s_changes[i].s_len;
+
+    struct delta *d = malloc((n ? n : 1) * sizeof(*d));
+    if (!d)
+        model_fatal("history index: out of memory");
+    size_t k = 0;
+    for (int i = 0; i < x->s_children; ++i) {
+        const BalanceChanges *c = &x->s_changes[i];
+        BalanceState prev = { 0, 0, 0 };
+        for (uint32_t j = 0; j < c->s_len; ++j) {
+            const BalanceState *s = &c->s_points[j];
+            d[k++] = (struct delta) { s->s_time, s->s_balance - prev.s_balance,
+                                      s->s_balance_pending_in - prev.s_balance_pending_in };
+            prev = *s;
+        }
+        if (c->s_end > x->s_total.s_end)
+            x->s_total.s_end = c->s_end;
+    }
+    qsort(d, n, sizeof(*d), by_time);
+
+    BalanceChanges *t = &x->s_total;
+    BalanceState sum = { 0, 0, 0 };
+    for (size_t i = 0; i < n; ++i) {
+        sum.s_balance += d[i].balance;
+        sum.s_balance_pending_in += d[i].pending;
+        if (i + 1 < n && d[i + 1].time == d[i].time)
+            continue;
+        changes_reserve(t, t->s_len + 1);
+        sum.s_time = d[i].time;
+        t->s_points[t->s_len++] = sum;
+    }
+    free(d);
+}
+
+/* Bottom-up tree: node i holds the max of nodes 2i and 2i + 1, point j of
+ * s_total is leaf s_leaves + j. */
+static void build_tree(HistoryIndex *x) {
+    uint32_t leaves = 1;
+    while (leaves < x->s_total.s_len)
+        leaves *= 2;
+    x->s_leaves = leaves;
+    x->s_max_pending = calloc(2 * (size_t) leaves, sizeof(*x->s_max_pending));
+    if (!x->s_max_pending)
+        model_fatal("history index: out of memory");
+
+    for (uint32_t j = 0; j < x->s_total.s_len; ++j)
+        x->s_max_pending[leaves + j] = x->s_total.s_points[j].s_balance_pending_in;
+    for (uint32_t i = leaves - 1; i > 0; --i) {
+        balance_t l = x->s_max_pending[2 * i], r = x->s_max_pending[2 * i + 1];
+        x->s_max_pending[i] = l > r ? l : r;
+    }
+}
+
+void history_index_build(HistoryIndex *x, BalanceChanges *changes, int children) {
+    *x = (HistoryIndex) { 0 };
+    x->s_children = children;
+    x->s_changes = changes;
+    for (int i = 0; i < children; ++i)
+        changes_fold(&changes[i]);
+    build_total(x);
+    build_tree(x);
+}
+
+balance_t balance_at(const HistoryIndex *x, local_id id, timestamp_t t) {
+    if (id < 1 || id > x->s_children)
+        model_fatal("balance_at: no child %d", id);
+    return state_at(&x->s_changes[id - 1], t).s_balance;
+}
+
+balance_t total_at(const HistoryIndex *x, timestamp_t t) {
+    return state_at(&x->s_total, t).s_balance;
+}
+
+balance_t in_flight_at(const HistoryIndex *x, timestamp_t t) {
+    return state_at(&x->s_total, t).s_balance_pending_in;
+}
+
+balance_t max_in_flight(const HistoryIndex *x, timestamp_t from, timestamp_t to) {
+    int64_t l = find(&x->s_total, from), r = find(&x->s_total, to);
+    if (from > to || r < 0)
+        return 0;
+    /* before the first point nothing is in flight */
+    balance_t best = l < 0 ? 0 : x->s_max_pending[x->s_leaves + l];
+    if (l < 0)
+        l = 0;
+    for (l += x->s_leaves, r += x->s_leaves + 1; l < r; l /= 2, r /= 2) {
+        if (l & 1) {
+            balance_t v = x->s_max_pending[l++];
+            best = v > best ? v : best;
+        }
+        if (r & 1) {
+            balance_t v = x->s_max_pending[--r];
+            best = v > best ? v : best;
+        }
+    }
+    return best;
+}
+
+void history_index_free(HistoryIndex *x) {
+    for (int i = 0; i < x->s_children; ++i)
+        changes_free(&x->s_changes[i]);
+    free(x->s_changes);
+    changes_free(&x->s_total);
+    free(x->s_max_pending);
+    *x = (HistoryIndex) { 0 };
+}
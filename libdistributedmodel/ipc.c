@@ -0,0 +1,511 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "ipc.h"
+
+/*
+ * Public message.h API.  Argument checking and the emulated clock live here;
+ * moving bytes is left to the transport picked at startup:
+ *
+ *   DISTRIBUTED_MODEL_TRANSPORT=pipe   pipes + epoll (default)
+ *   DISTRIBUTED_MODEL_TRANSPORT=shm    shared-memory rings + futex
+ */
+
+static const struct transport *transport = &pipe_transport;
+
+/* at most one message is lent out at a time */
+static const Message *view = NULL;
+static local_id view_from = 0;
+
+/*
+ * Opt-in coalescing: messages to the same destination pile up in a batch
+ * until the process is about to block in a receive or calls flush(), then
+ * go out in one write.  A batch never exceeds MAX_MESSAGE_LEN (== PIPE_BUF),
+ * so pipes still deliver it atomically, and receivers see the same messages
+ * in the same order as without coalescing.
+ */
+struct batch {
+    size_t len;
+    bool queued;                ///< listed in pending[]
+    char data[MAX_MESSAGE_LEN];
+};
+
+static struct batch *batches = NULL;    ///< per destination, NULL when disabled
+static local_id *pending = NULL;        ///< destinations with a non-empty batch
+static int npending = 0;
+
+/*
+ * Selective receive: a message that receive_type_view() or
+ * receive_any_of_view() does not want is copied to the mailbox of its
+ * sender and type.  Every receive looks there first and takes the oldest
+ * message it may, so each channel is still read in the order it was sent.
+ */
+struct stashed {
+    struct stashed *next;
+    uint64_t seq;               ///< order of arrival over all mailboxes
+    Message msg;                ///< allocated up to the end of the payload
+};
+
+struct mailbox {
+    struct stashed *head, *tail;
+};
+
+static struct mailbox *mailboxes = NULL;    ///< [from * MESSAGE_TYPES + type]
+static int *nstashed_from = NULL;           ///< messages kept per sender
+static int nstashed = 0;
+static uint64_t next_seq = 0;
+static struct stashed *view_stashed = NULL; ///< the view, if lent from a mailbox
+
+/* ---------------- setup ---------------- */
+void ipc_init(int nprocs) {
+    const char *name = getenv("DISTRIBUTED_MODEL_TRANSPORT");
+    if (name && strcmp(name, shm_transport.name) == 0)
+        transport = &shm_transport;
+    else if (name && strcmp(name, pipe_transport.name) != 0)
+        model_fatal("Unknown transport: %s", name);
+
+    model_nprocs = nprocs;
+    transport->init(nprocs);
+}
+
+void ipc_attach(local_id self) {
+    model_self = self;
+    transport->attach(self);
+}
+
+static void free_mailboxes(void);
+
+void ipc_detach(void) {
+    set_coalescing(false);
+    free_mailboxes();
+    transport->detach();
+}
+
+/* ---------------- checks ---------------- */
+static void check_message(const Message *msg) {
+    if (!msg)
+        model_fatal("Msg is NULL during send");
+    if (msg->s_header.s_payload_len > MAX_PAYLOAD_LEN)
+        model_fatal("msg is too long: %d", msg->s_header.s_payload_len);
+}
+
+static void check_destination(local_id dst) {
+    if (dst == model_self)
+        model_fatal("Process %d tries to send message to itself", model_self);
+    if (dst < 0 || dst >= model_nprocs)
+        model_fatal("Process %d tries to send message to non-existed process %d",
+                    model_self, dst);
+}
+
+/* Builds the header that send_iov() puts in front of the fragments. */
+static MessageHeader iov_header(MessageType type, timestamp_t time,
+                                const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    if (iovcnt < 0 || iovcnt > SEND_IOV_MAX || (iovcnt && !iov))
+        model_fatal("Wrong amount of payload fragments: %d", iovcnt);
+    for (int i = 0; i < iovcnt; ++i)
+        len += iov[i].iov_len;
+    if (len > MAX_PAYLOAD_LEN)
+        model_fatal("msg is too long: %d", (int) len);
+
+    MessageHeader hdr = {
+        .s_magic = MESSAGE_MAGIC,
+        .s_payload_len = len,
+        .s_type = type,
+        .s_local_time = time
+    };
+    return hdr;
+}
+
+/* ---------------- coalescing ---------------- */
+static void flush_one(local_id dst) {
+    struct batch *b = &batches[dst];
+    if (b->len)
+        transport->send_batch(dst, b->data, b->len);
+    b->len = 0;
+}
+
+static void enqueue(local_id dst, const MessageHeader *hdr,
+                    const struct iovec *iov, int iovcnt) {
+    struct batch *b = &batches[dst];
+    if (b->len + sizeof(*hdr) + hdr->s_payload_len > sizeof(b->data))
+        flush_one(dst);
+    if (!b->queued) {
+        b->queued = true;
+        pending[npending++] = dst;
+    }
+
+    memcpy(b->data + b->len, hdr, sizeof(*hdr));
+    b->len += sizeof(*hdr);
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len)
+            memcpy(b->data + b->len, iov[i].iov_base, iov[i].iov_len);
+        b->len += iov[i].iov_len;
+    }
+}
+
+void flush(void) {
+    for (int i = 0; i < npending; ++i) {
+        flush_one(pending[i]);
+        batches[pending[i]].queued = false;
+    }
+    npending = 0;
+}
+
+void set_coalescing(bool enabled) {
+    if (enabled == (batches != NULL))
+        return;
+    if (enabled) {
+        batches = calloc(model_nprocs, sizeof(*batches));
+        pending = malloc(sizeof(*pending) * model_nprocs);
+        if (!batches || !pending)
+            model_fatal("Failed to allocate memory for connectors");
+    } else {
+        flush();
+        free(batches);
+        free(pending);
+        batches = NULL;
+        pending = NULL;
+    }
+}
+
+static void deliver(local_id dst, const Message *msg) {
+    if (batches) {
+        struct iovec payload = { (void *) msg->s_payload, msg->s_header.s_payload_len };
+        enqueue(dst, &msg->s_header, &payload, 1);
+    } else {
+        transport->send(dst, msg);
+    }
+}
+
+static void deliver_iov(local_id dst, const MessageHeader *hdr,
+                        const struct iovec *iov, int iovcnt) {
+    if (batches)
+        enqueue(dst, hdr, iov, iovcnt);
+    else
+        transport->sendv(dst, hdr, iov, iovcnt);
+}
+
+/* Queued messages must stay ahead of a multicast, so while coalescing it is
+ * queued per destination like any other message. */
+static void deliver_multicast(const MessageHeader *hdr,
+                              const struct iovec *iov, int iovcnt) {
+    if (!batches) {
+        transport->multicast(hdr, iov, iovcnt);
+        return;
+    }
+    for (local_id dst = 0; dst < model_nprocs; ++dst) {
+        if (dst != model_self)
+            enqueue(dst, hdr, iov, iovcnt);
+    }
+}
+
+/* ---------------- message.h API ---------------- */
+void fill_message(Message *msg, MessageType type, timestamp_t time,
+                  void *payload, size_t psize) {
+    msg->s_header.s_magic = MESSAGE_MAGIC;
+    msg->s_header.s_type = type;
+    msg->s_header.s_local_time = time;
+    msg->s_header.s_payload_len = psize;
+    if (psize && payload)
+        memcpy(msg->s_payload, payload, psize);
+}
+
+int send(local_id dst, const Message *msg) {
+    check_message(msg);
+    check_destination(dst);
+
+    if (model_self == PARENT_ID)
+        clock_tick();
+    deliver(dst, msg);
+    return 0;
+}
+
+int send_multicast(const Message *msg) {
+    check_message(msg);
+
+    if (model_self == PARENT_ID)
+        clock_tick();
+    struct iovec payload = { (void *) msg->s_payload, msg->s_header.s_payload_len };
+    deliver_multicast(&msg->s_header, &payload, 1);
+    return 0;
+}
+
+int send_iov(local_id dst, MessageType type, timestamp_t time,
+             const struct iovec *iov, int iovcnt) {
+    MessageHeader hdr = iov_header(type, time, iov, iovcnt);
+    check_destination(dst);
+
+    if (model_self == PARENT_ID)
+        clock_tick();
+    deliver_iov(dst, &hdr, iov, iovcnt);
+    return 0;
+}
+
+int send_multicast_iov(MessageType type, timestamp_t time,
+                       const struct iovec *iov, int iovcnt) {
+    MessageHeader hdr = iov_header(type, time, iov, iovcnt);
+
+    if (model_self == PARENT_ID)
+        clock_tick();
+    deliver_multicast(&hdr, iov, iovcnt);
+    return 0;
+}
+
+/* ---------------- mailboxes ---------------- */
+static struct mailbox *mailbox(local_id from, int type) {
+    return &mailboxes[from * MESSAGE_TYPES + type];
+}
+
+static void stash(local_id from, const Message *msg) {
+    int type = msg->s_header.s_type;
+    if (type < 0 || type >= MESSAGE_TYPES)
+        model_fatal("Process %d got a message of unknown type %d from %d",
+                    model_self, type, from);
+    if (!mailboxes) {
+        mailboxes = calloc((size_t) model_nprocs * MESSAGE_TYPES, sizeof(*mailboxes));
+        nstashed_from = calloc(model_nprocs, sizeof(*nstashed_from));
+        if (!mailboxes || !nstashed_from)
+            model_fatal("Failed to allocate memory for mailboxes");
+    }
+
+    size_t len = sizeof(msg->s_header) + msg->s_header.s_payload_len;
+    struct stashed *s = malloc(offsetof(struct stashed, msg) + len);
+    if (!s)
+        model_fatal("Failed to allocate memory for mailboxes");
+    s->next = NULL;
+    s->seq = next_seq++;
+    memcpy(&s->msg, msg, len);
+
+    struct mailbox *b = mailbox(from, type);
+    if (b->tail)
+        b->tail->next = s;
+    else
+        b->head = s;
+    b->tail = s;
+    ++nstashed_from[from];
+    ++nstashed;
+}
+
+static struct stashed *pop(struct mailbox *b, local_id from) {
+    struct stashed *s = b->head;
+    if (!(b->head = s->next))
+        b->tail = NULL;
+    --nstashed_from[from];
+    --nstashed;
+    return s;
+}
+
+/* Oldest kept message of `from` (-1 for anyone) whose type is in types,
+ * NULL if there is none. */
+static struct stashed *take(local_id from, uint32_t types, local_id *sender) {
+    if (!nstashed)
+        return NULL;
+
+    struct mailbox *best = NULL;
+    local_id lo = from < 0 ? 0 : from, hi = from < 0 ? model_nprocs - 1 : from;
+    for (local_id i = lo; i <= hi; ++i) {
+        if (!nstashed_from[i])
+            continue;
+        for (int t = 0; t < MESSAGE_TYPES; ++t) {
+            struct mailbox *b = mailbox(i, t);
+            if (b->head && (types & MESSAGE_TYPE_BIT(t))
+                    && (!best || b->head->seq < best->head->seq)) {
+                best = b;
+                *sender = i;
+            }
+        }
+    }
+    return best ? pop(best, *sender) : NULL;
+}
+
+static const Message *lend(struct stashed *s, local_id from) {
+    view_stashed = s;
+    view_from = from;
+    view = &s->msg;
+    return view;
+}
+
+static void copy_out(Message *msg, struct stashed *s) {
+    memcpy(msg, &s->msg, sizeof(s->msg.s_header) + s->msg.s_header.s_payload_len);
+    free(s);
+}
+
+static void free_mailboxes(void) {
+    for (int i = 0; mailboxes && i < model_nprocs * MESSAGE_TYPES; ++i) {
+        while (mailboxes[i].head) {
+            struct stashed *s = mailboxes[i].head;
+            mailboxes[i].head = s->next;
+            free(s);
+        }
+    }
+    free(mailboxes);
+    free(nstashed_from);
+    free(view_stashed);
+    mailboxes = NULL;
+    nstashed_from = NULL;
+    view_stashed = NULL;
+    nstashed = 0;
+}
+
+static void before_receive(void) {
+    if (view)
+        model_fatal("Process %d receives while holding a message from %d",
+                    model_self, view_from);
+}
+
+static void check_source(local_id from) {
+    before_receive();
+    if (from == model_self)
+        model_fatal("Process %d tries to receive message from itself", model_self);
+    if (from < 0 || from >= model_nprocs)
+        model_fatal("Failed to receive from %d", from);
+}
+
+/*
+ * Queued messages only have to be out before the process blocks, so a
+ * receive first looks without waiting and flushes only if that comes up
+ * empty.  While input keeps arriving, replies keep piling up.
+ */
+static void peek_from(local_id from, const Message **msg) {
+    int r = transport->peek(from, msg, npending == 0);
+    if (r == RECV_EMPTY) {
+        flush();
+        r = transport->peek(from, msg, true);
+    }
+    if (r == RECV_EOF)
+        model_fatal("Reading from closed process %d", from);
+}
+
+static local_id peek_any(const Message **msg) {
+    local_id from = transport->peek_any(msg, npending == 0);
+    if (from < 0) {
+        flush();
+        from = transport->peek_any(msg, true);
+    }
+    return from;
+}
+
+int receive(local_id from, Message *msg) {
+    check_source(from);
+    struct stashed *s = take(from, ALL_MESSAGE_TYPES, &from);
+    if (s) {
+        copy_out(msg, s);
+        return 0;
+    }
+    int r = transport->recv(from, msg, npending == 0);
+    if (r == RECV_EMPTY) {
+        flush();
+        r = transport->recv(from, msg, true);
+    }
+    if (r == RECV_EOF)
+        model_fatal("Reading from closed process %d", from);
+    return 0;
+}
+
+int receive_any(Message *msg) {
+    before_receive();
+    local_id from;
+    struct stashed *s = take(-1, ALL_MESSAGE_TYPES, &from);
+    if (s) {
+        copy_out(msg, s);
+        return from;
+    }
+    from = transport->recv_any(msg, npending == 0);
+    if (from < 0) {
+        flush();
+        from = transport->recv_any(msg, true);
+    }
+    return from;
+}
+
+/* ---------------- ipc.h API ---------------- */
+const Message *receive_view(local_id from) {
+    check_source(from);
+    struct stashed *s = take(from, ALL_MESSAGE_TYPES, &from);
+    if (s)
+        return lend(s, from);
+    peek_from(from, &view);
+    view_from = from;
+    return view;
+}
+
+const Message *receive_any_view(local_id *from) {
+    return receive_any_of_view(ALL_MESSAGE_TYPES, from);
+}
+
+const Message *try_receive_any_view(local_id *from) {
+    return try_receive_any_of_view(ALL_MESSAGE_TYPES, from);
+}
+
+const Message *receive_type_view(local_id from, MessageType type) {
+    check_source(from);
+    if ((int) type < 0 || (int) type >= MESSAGE_TYPES)
+        model_fatal("Process %d waits for unknown message type %d", model_self, type);
+    if (mailboxes && mailbox(from, type)->head)
+        return lend(pop(mailbox(from, type), from), from);
+
+    for (;;) {
+        const Message *msg;
+        peek_from(from, &msg);
+        if (msg->s_header.s_type == type) {
+            view = msg;
+            view_from = from;
+            return view;
+        }
+        stash(from, msg);
+        transport->release(from);
+    }
+}
+
+/* Unwanted messages go to their mailboxes until a wanted one comes, or
+ * until nothing is waiting if block is false. */
+static const Message *any_of(uint32_t types, local_id *from, bool block) {
+    before_receive();
+    local_id sender;
+    struct stashed *s = take(-1, types, &sender);
+    if (s) {
+        if (from)
+            *from = sender;
+        return lend(s, sender);
+    }
+
+    for (;;) {
+        const Message *msg;
+        sender = block ? peek_any(&msg) : transport->peek_any(&msg, false);
+        if (sender < 0)
+            return NULL;
+        int type = msg->s_header.s_type;
+        if (type >= 0 && type < 32 && (types & MESSAGE_TYPE_BIT(type))) {
+            view = msg;
+            view_from = sender;
+            if (from)
+                *from = sender;
+            return view;
+        }
+        stash(sender, msg);
+        transport->release(sender);
+    }
+}
+
+const Message *receive_any_of_view(uint32_t types, local_id *from) {
+    return any_of(types, from, true);
+}
+
+const Message *try_receive_any_of_view(uint32_t types, local_id *from) {
+    return any_of(types, from, false);
+}
+
+void release_view(const Message *msg) {
+    if (!view || msg != view)
+        model_fatal("Process %d releases a message it does not hold", model_self);
+    if (view_stashed) {
+        free(view_stashed);
+        view_stashed = NULL;
+    } else {
+        transport->release(view_from);
+    }
+    view = NULL;
+}
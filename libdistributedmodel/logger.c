@@ -0,0 +1,55 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "model.h"
+#include "log.h"
+
+static const char * const events_log = "events.log";
+
+static int logfd = -1;
+
+/* ---------------- setup ---------------- */
+void logger_init(void) {
+    logfd = open(events_log, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (logfd < 0)
+        model_fatal("Failed to open %s", events_log);
+}
+
+/* One write() per line keeps lines from different processes whole. */
+static void write_line(int fd, const char *s, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        s += n;
+        len -= n;
+    }
+}
+
+/* ---------------- log.h API ---------------- */
+void shared_logger(const char *msg) {
+    size_t len = strlen(msg);
+    write_line(STDOUT_FILENO, msg, len);
+    if (logfd >= 0)
+        write_line(logfd, msg, len);
+}
+
+void print(const char *s) {
+    if (model_mutex &&
+        __atomic_add_fetch(&model_shared->in_cs, 1, __ATOMIC_SEQ_CST) != 1)
+        model_fatal("Safety property isn't satisfied, multiple processes "
+                    "calling print() at the same time. Detected in process %d",
+                    model_self);
+
+    shared_logger(s);
+
+    if (model_mutex)
+        __atomic_sub_fetch(&model_shared->in_cs, 1, __ATOMIC_SEQ_CST);
+}
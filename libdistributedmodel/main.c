@@ -0,0 +1,110 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "model.h"
+#include "process.h"
+
+local_id model_self = PARENT_ID;
+int      model_nprocs = 0;
+bool     model_mutex = false;
+
+struct model_shared *model_shared = NULL;
+
+/* ---------------- errors ---------------- */
+void model_fatal(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s -l LAB [-m] [-w WORKLOAD] -p N [balance...], N = {1..%d}\n",
+            prog, MAX_PROCESS_ID);
+    exit(EXIT_FAILURE);
+}
+
+/* ---------------- entry point ---------------- */
+int main(int argc, char *argv[]) {
+    int lab = 1;
+    int nchildren = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:p:mw:")) != -1) {
+        switch (opt) {
+        case 'l':
+            lab = atoi(optarg);
+            break;
+        case 'p':
+            nchildren = atoi(optarg);
+            break;
+        case 'm':
+            model_mutex = true;
+            break;
+        case 'w':
+            workload_init(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (lab < 1 || lab > 4)
+        model_fatal("Lab number is incorrect: %u", (unsigned) lab);
+    if (nchildren < 1 || nchildren > MAX_PROCESS_ID)
+        usage(argv[0]);
+
+    /* labs 2 and 3 take one starting balance per child */
+    bool banking = (lab == 2 || lab == 3);
+    if (banking && argc - optind != nchildren)
+        usage(argv[0]);
+
+    model_shared = mmap(NULL, sizeof(*model_shared), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (model_shared == MAP_FAILED)
+        model_fatal("Failed to create topology");
+
+    signal(SIGPIPE, SIG_IGN);
+    logger_init();
+    ipc_init(nchildren + 1);
+    fflush(stdout);
+
+    for (local_id id = 1; id <= nchildren; ++id) {
+        pid_t cpid = fork();
+        if (cpid < 0)
+            model_fatal("Fail during fork of processes");
+        if (cpid == 0) {
+            struct child_arguments args = {
+                .self_id = id,
+                .count_nodes = nchildren + 1,
+                .balance = banking ? atoi(argv[optind + id - 1]) : 0,
+                .mutex_usage = model_mutex,
+            };
+            ipc_attach(id);
+            child_work(args);
+            ipc_detach();
+            exit(EXIT_SUCCESS);
+        }
+    }
+
+    ipc_attach(PARENT_ID);
+    parent_work(nchildren + 1);
+    ipc_detach();
+
+    int status, failed = 0;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = 1;
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file     model.h
+ * @brief    Internal state shared by the translation units of libdistributedmodel
+ *
+ * Nothing in here is part of the lab ABI: labs only see labs_headers/.
+ */
+
+#ifndef DISTRIBUTED_MODEL_INTERNAL_H
+#define DISTRIBUTED_MODEL_INTERNAL_H
+
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#include "message.h"
+#include "banking.h"
+
+/* ---------------- process identity ---------------- */
+extern local_id model_self;     ///< local id of the calling process
+extern int      model_nprocs;   ///< parent + children
+extern bool     model_mutex;    ///< -m was given (lab 4 safety checks)
+
+/* ---------------- state shared across fork() ---------------- */
+struct model_shared {
+    int64_t clock;              ///< emulated physical time
+    int in_cs;                  ///< processes currently inside print()
+};
+
+extern struct model_shared *model_shared;
+
+/* ---------------- errors ---------------- */
+/** Prints the message to stderr and terminates the calling process. */
+void model_fatal(const char *fmt, ...)
+    __attribute__((noreturn, format(printf, 1, 2)));
+
+/* ---------------- transports ---------------- */
+enum { RECV_OK = 0, RECV_EMPTY, RECV_EOF };
+
+/**
+ * A transport moves whole, already validated messages between processes.
+ * ipc.c owns argument checking and the public message.h API on top of it.
+ */
+struct transport {
+    const char *name;
+    /** Sets up whatever the channels need from before fork(). */
+    void (*init)(int nprocs);
+    /** Keeps what belongs to self, after fork(). */
+    void (*attach)(local_id self);
+    /** Closes the remaining channel ends of the calling process. */
+    void (*detach)(void);
+    void (*send)(local_id dst, const Message *msg);
+    /** Sends hdr followed by the fragments as one message. */
+    void (*sendv)(local_id dst, const MessageHeader *hdr,
+                  const struct iovec *iov, int iovcnt);
+    /** Sends hdr followed by the fragments to every other process. */
+    void (*multicast)(const MessageHeader *hdr,
+                      const struct iovec *iov, int iovcnt);
+    /** Sends back-to-back messages (at most MAX_MESSAGE_LEN bytes) at once. */
+    void (*send_batch)(local_id dst, const char *buf, size_t len);
+    /** Returns RECV_*; with block == false an empty channel is RECV_EMPTY. */
+    int (*recv)(local_id from, Message *msg, bool block);
+    /** Returns the sender of the next message from any channel; with
+     *  block == false it returns -1 instead of waiting for one. */
+    local_id (*recv_any)(Message *msg, bool block);
+    /** Like recv/recv_any, but lends the message instead of copying it out.
+     *  The view stays valid until release(from). */
+    int (*peek)(local_id from, const Message **msg, bool block);
+    local_id (*peek_any)(const Message **msg, bool block);
+    void (*release)(local_id from);
+};
+
+extern const struct transport pipe_transport;
+extern const struct transport shm_transport;
+
+/* ---------------- ipc.c ---------------- */
+/** Selects the transport named by $DISTRIBUTED_MODEL_TRANSPORT and inits it. */
+void ipc_init(int nprocs);
+void ipc_attach(local_id self);
+void ipc_detach(void);
+
+/* ---------------- logger.c ---------------- */
+void logger_init(void);
+
+/* ---------------- banking.c ---------------- */
+void clock_tick(void);
+
+/* ---------------- history.c ---------------- */
+/** Makes room for at least n points in the changes. */
+void changes_reserve(BalanceChanges *changes, uint32_t n);
+
+/** Folds the pending deltas into the points, dropping points that change nothing. */
+void changes_fold(BalanceChanges *changes);
+
+/* ---------------- workload.c ---------------- */
+/** Parses the -w argument, terminates the model if it is malformed. */
+void workload_init(const char *spec);
+
+#endif // DISTRIBUTED_MODEL_INTERNAL_H
@@ -0,0 +1,466 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "model.h"
+#include "ipc.h"
+#include "handoff.h"
+
+/*
+ * Every ordered pair of processes that actually talks owns one pipe, created
+ * by the sender on its first send.  The read end travels to the receiver
+ * over a one-shot connection to the receiver's listening unix socket
+ * (SCM_RIGHTS); those listeners, one per process, are all that exists before
+ * fork(), so descriptors grow with the peers a process talks to instead of
+ * with N^2.
+ *
+ * Writes never exceed PIPE_BUF, so each one lands atomically.  Read ends are
+ * non-blocking and drained into a per-channel buffer as far as it goes, so
+ * one read() picks up everything a peer managed to send; messages are then
+ * lent straight out of that buffer.  receive_any() parks in epoll_wait()
+ * across all inbound pipes and the listener, receive() parks in poll() on
+ * the one it was asked for.
+ *
+ * A peer that exits without ever opening a channel to us leaves nothing to
+ * read EOF from, so every process publishes in shared memory whether it
+ * has detached and whom it is waiting for a channel from; a detaching
+ * process connects once more to each waiter it would otherwise strand.
+ */
+
+enum {
+    WAIT_NONE = 0,
+    WAIT_ANY = -1               ///< otherwise the awaited peer's id + 1
+};
+
+#define LISTENER UINT32_MAX     ///< epoll tag of the listening socket
+
+struct presence {
+    int32_t closed;             ///< detached, no channel will come any more
+    int32_t waiting;            ///< WAIT_* or id + 1 of the awaited peer
+};
+
+/* ---------------- channel table ---------------- */
+static int *listen_fd = NULL;       ///< per process, only own one after attach
+static int *rd_fd = NULL;           ///< read end of channel from peer, -1 until opened
+static int *wr_fd = NULL;           ///< write end of channel to peer, -1 until opened
+static struct presence *presence = NULL;   ///< per process, shared
+static pid_t owner = 0;             ///< pid of the model's parent, names the sockets
+
+/* Bytes read from one inbound pipe and not consumed yet.  Room for a
+ * partial message plus a full PIPE_BUF read. */
+struct inbuf {
+    size_t start, end;
+    char data[2 * MAX_MESSAGE_LEN];
+};
+
+static struct inbuf **in = NULL;    ///< per sender, allocated on first read
+static int nbuffered = 0;           ///< inbufs holding unconsumed bytes
+
+/* ---------------- receive_any() state ---------------- */
+static int epfd = -1;
+static int open_inbound = 0;
+static struct epoll_event *ready = NULL;
+static int ready_cnt = 0;
+static int ready_pos = 0;
+static local_id next_buffered = 0;  ///< round-robin cursor over inbufs
+
+/* ---------------- setup ---------------- */
+static void pipe_init(int nprocs) {
+    owner = getpid();
+    listen_fd = malloc(sizeof(int) * nprocs);
+    presence = mmap(NULL, sizeof(*presence) * nprocs, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!listen_fd || presence == MAP_FAILED)
+        model_fatal("Failed to allocate memory for connectors");
+
+    for (local_id id = 0; id < nprocs; ++id) {
+        if ((listen_fd[id] = handoff_listen(owner, id, nprocs)) < 0)
+            model_fatal("Failed to create topology");
+    }
+}
+
+static void pipe_detach(void);
+
+static void pipe_attach(local_id self) {
+    for (local_id id = 0; id < model_nprocs; ++id) {
+        if (id != self)
+            close(listen_fd[id]);
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    ready = malloc(sizeof(*ready) * model_nprocs);
+    in = calloc(model_nprocs, sizeof(*in));
+    rd_fd = malloc(sizeof(int) * model_nprocs);
+    wr_fd = malloc(sizeof(int) * model_nprocs);
+    if (epfd < 0 || !ready || !in || !rd_fd || !wr_fd)
+        model_fatal("Failed to create topology");
+    for (local_id id = 0; id < model_nprocs; ++id)
+        rd_fd[id] = wr_fd[id] = -1;
+
+    int fd = listen_fd[self];
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = LISTENER };
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        model_fatal("Failed to create topology");
+
+    /* peers waiting for a channel must learn about model_fatal() too */
+    atexit(pipe_detach);
+}
+
+/* Write end of the channel to dst, creating the channel on first use. */
+static int outbound(local_id dst) {
+    if (wr_fd[dst] >= 0)
+        return wr_fd[dst];
+
+    int fds[2];
+    if (pipe(fds) < 0)
+        model_fatal("Failed to create topology");
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    if (!handoff_send(owner, dst, model_self, fds[0]))
+        model_fatal("Failed to send message to %d", dst);
+    close(fds[0]);
+    return wr_fd[dst] = fds[1];
+}
+
+/* Takes every pending connection: a new channel, or word that a peer left. */
+static void accept_channels(void) {
+    int from, fd, r;
+    while ((r = handoff_accept(listen_fd[model_self], &from, &fd)) > 0) {
+        if (from < 0 || from >= model_nprocs || from == model_self || rd_fd[from] >= 0)
+            model_fatal("Failed to create topology");
+        if (fd < 0)
+            continue;               /* `from` left, presence says so */
+        rd_fd[from] = fd;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = from };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+            model_fatal("Failed to create topology");
+        ++open_inbound;
+    }
+    if (r < 0)
+        model_fatal("Failed to create topology");
+}
+
+static bool peer_closed(local_id id) {
+    return __atomic_load_n(&presence[id].closed, __ATOMIC_SEQ_CST);
+}
+
+/* Sleeps until a connection arrives, unless `closed` already holds; the
+ * detaching side checks `waiting` after raising its flag, so one of the two
+ * always sees the other. */
+static void await_connection(int32_t waiting, bool (*closed)(local_id), local_id id) {
+    struct presence *me = &presence[model_self];
+    __atomic_store_n(&me->waiting, waiting, __ATOMIC_SEQ_CST);
+    if (!closed(id)) {
+        struct pollfd p = { .fd = listen_fd[model_self], .events = POLLIN };
+        while (poll(&p, 1, -1) < 0 && errno == EINTR)
+            ;
+    }
+    __atomic_store_n(&me->waiting, WAIT_NONE, __ATOMIC_RELAXED);
+}
+
+/* Whether nobody could ever open another channel to us. */
+static bool everyone_closed(local_id unused) {
+    (void) unused;
+    for (local_id id = 0; id < model_nprocs; ++id) {
+        if (id != model_self && rd_fd[id] < 0 && !peer_closed(id))
+            return false;
+    }
+    return true;
+}
+
+static void pipe_detach(void) {
+    if (!rd_fd)
+        return;
+
+    __atomic_store_n(&presence[model_self].closed, 1, __ATOMIC_SEQ_CST);
+    for (local_id id = 0; id < model_nprocs; ++id) {
+        if (id == model_self || wr_fd[id] >= 0)
+            continue;               /* closing the pipe is EOF enough */
+        int32_t w = __atomic_load_n(&presence[id].waiting, __ATOMIC_SEQ_CST);
+        if (w == WAIT_ANY || w == model_self + 1)
+            handoff_send(owner, id, model_self, -1);
+    }
+
+    for (local_id id = 0; id < model_nprocs; ++id) {
+        if (rd_fd[id] >= 0) close(rd_fd[id]);
+        if (wr_fd[id] >= 0) close(wr_fd[id]);
+    }
+    close(listen_fd[model_self]);
+    if (epfd >= 0)
+        close(epfd);
+    free(rd_fd);
+    free(wr_fd);
+    free(listen_fd);
+    free(ready);
+    for (int i = 0; in && i < model_nprocs; ++i)
+        free(in[i]);
+    free(in);
+    rd_fd = wr_fd = listen_fd = NULL;
+    ready = NULL;
+    in = NULL;
+    epfd = -1;
+}
+
+/* ---------------- low level i/o ---------------- */
+static void wait_readable(int fd) {
+    struct pollfd p = { .fd = fd, .events = POLLIN };
+    while (poll(&p, 1, -1) < 0 && errno == EINTR)
+        ;
+}
+
+static struct inbuf *inbuf(local_id from) {
+    if (!in[from] && !(in[from] = calloc(1, sizeof(struct inbuf))))
+        model_fatal("Failed to allocate memory for connectors");
+    return in[from];
+}
+
+/* The whole message at the front of the buffer, NULL if it is not all in. */
+static const Message *front(local_id from, const struct inbuf *b) {
+    size_t avail = b->end - b->start;
+    const Message *m = (const Message *) (b->data + b->start);
+
+    if (avail < sizeof(MessageHeader))
+        return NULL;
+    if (m->s_header.s_magic != MESSAGE_MAGIC)
+        model_fatal("Wrong s_magic: %d from %d, proc %d",
+                    m->s_header.s_magic, from, model_self);
+    if (m->s_header.s_payload_len > MAX_PAYLOAD_LEN)
+        model_fatal("msg is too long: %d", m->s_header.s_payload_len);
+    if (avail < sizeof(MessageHeader) + m->s_header.s_payload_len)
+        return NULL;
+    return m;
+}
+
+/* One read() of whatever the pipe holds.  Returns RECV_OK if bytes came in,
+ * RECV_EMPTY if there were none and RECV_EOF once the writer is gone. */
+static int fill(local_id from) {
+    int fd = rd_fd[from];
+    struct inbuf *b = inbuf(from);
+
+    /* at most a partial message is left over, move it to the front */
+    if (sizeof(b->data) - b->end < MAX_MESSAGE_LEN) {
+        memmove(b->data, b->data + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+    }
+
+    for (;;) {
+        ssize_t n = read(fd, b->data + b->end, sizeof(b->data) - b->end);
+        if (n > 0) {
+            if (b->start == b->end)
+                ++nbuffered;
+            b->end += n;
+            return RECV_OK;
+        }
+        if (n == 0) {
+            if (b->start != b->end)
+                model_fatal("Failed to read payload from %d using fd %d", from, fd);
+            return RECV_EOF;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            model_fatal("Failed to read message header from %d using fd %d", from, fd);
+        return RECV_EMPTY;
+    }
+}
+
+/* Waits for the channel from `from` to be opened, RECV_EOF if it never will. */
+static int inbound(local_id from, bool block) {
+    for (;;) {
+        bool closed = peer_closed(from);
+        accept_channels();
+        if (rd_fd[from] >= 0)
+            return RECV_OK;
+        if (closed)
+            return RECV_EOF;
+        if (!block)
+            return RECV_EMPTY;
+        await_connection(from + 1, peer_closed, from);
+    }
+}
+
+static int pipe_peek(local_id from, const Message **msg, bool block) {
+    if (rd_fd[from] < 0) {
+        int r = inbound(from, block);
+        if (r != RECV_OK)
+            return r;
+    }
+    for (;;) {
+        if (in[from] && (*msg = front(from, in[from])))
+            return RECV_OK;
+        int r = fill(from);
+        if (r == RECV_EOF)
+            return RECV_EOF;
+        if (r == RECV_EMPTY) {
+            if (!block)
+                return RECV_EMPTY;
+            wait_readable(rd_fd[from]);
+        }
+    }
+}
+
+static void pipe_release(local_id from) {
+    struct inbuf *b = in[from];
+    const Message *m = (const Message *) (b->data + b->start);
+
+    b->start += sizeof(MessageHeader) + m->s_header.s_payload_len;
+    if (b->start == b->end) {
+        b->start = b->end = 0;
+        --nbuffered;
+    }
+}
+
+static void copy_out(local_id from, const Message *view, Message *msg) {
+    memcpy(msg, view, sizeof(MessageHeader) + view->s_header.s_payload_len);
+    pipe_release(from);
+}
+
+static int pipe_recv(local_id from, Message *msg, bool block) {
+    const Message *view;
+    int r = pipe_peek(from, &view, block);
+    if (r == RECV_OK)
+        copy_out(from, view, msg);
+    return r;
+}
+
+/* Pipe messages are framed by their headers, so a batch is just the
+ * concatenation; it fits in PIPE_BUF and lands atomically like one message. */
+static void pipe_send_batch(local_id dst, const char *buf, size_t len) {
+    int fd = outbound(dst);
+
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            model_fatal("Failed to send message to %d using fd %d", dst, fd);
+        buf += n;
+        len -= n;
+    }
+}
+
+static void pipe_send(local_id dst, const Message *msg) {
+    pipe_send_batch(dst, (const char *) msg,
+                    sizeof(MessageHeader) + msg->s_header.s_payload_len);
+}
+
+static void pipe_sendv(local_id dst, const MessageHeader *hdr,
+                       const struct iovec *iov, int iovcnt) {
+    int fd = outbound(dst);
+    struct iovec v[SEND_IOV_MAX + 1];
+    size_t len = sizeof(*hdr) + hdr->s_payload_len;
+
+    v[0].iov_base = (void *) hdr;
+    v[0].iov_len = sizeof(*hdr);
+    for (int i = 0; i < iovcnt; ++i)
+        v[i + 1] = iov[i];
+
+    /* at most PIPE_BUF bytes, so a single writev() is atomic */
+    ssize_t n;
+    while ((n = writev(fd, v, iovcnt + 1)) < 0 && errno == EINTR)
+        ;
+    if (n != (ssize_t) len)
+        model_fatal("Failed to send message to %d using fd %d", dst, fd);
+}
+
+/* Every peer has its own pipe, so a multicast costs one write per peer. */
+static void pipe_multicast(const MessageHeader *hdr,
+                           const struct iovec *iov, int iovcnt) {
+    for (local_id dst = 0; dst < model_nprocs; ++dst) {
+        if (dst != model_self)
+            pipe_sendv(dst, hdr, iov, iovcnt);
+    }
+}
+
+static void drop_inbound(local_id from) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, rd_fd[from], NULL);
+    --open_inbound;
+}
+
+static local_id pipe_peek_any(const Message **msg, bool block) {
+    for (;;) {
+        /* Bytes already pulled into user space are invisible to epoll. */
+        for (int k = 0; nbuffered && k < model_nprocs; ++k) {
+            local_id from = (next_buffered + k) % model_nprocs;
+            if (in[from] && (*msg = front(from, in[from]))) {
+                next_buffered = (from + 1) % model_nprocs;
+                return from;
+            }
+        }
+
+        /* Serve every channel epoll reported once before asking again, so a
+         * chatty peer cannot starve the others. */
+        while (ready_pos < ready_cnt) {
+            uint32_t tag = ready[ready_pos++].data.u32;
+            if (tag == LISTENER) {
+                accept_channels();
+                continue;
+            }
+            local_id from = tag;
+            int r = fill(from);
+            if (r == RECV_OK && (*msg = front(from, in[from])))
+                return from;
+            if (r == RECV_EOF)
+                drop_inbound(from);
+        }
+
+        /* With no channel open, only a connection can wake us up. */
+        if (open_inbound == 0) {
+            accept_channels();
+            if (open_inbound == 0) {
+                if (everyone_closed(-1))
+                    model_fatal("receive_any failed on %d", model_self);
+                if (!block)
+                    return -1;
+                await_connection(WAIT_ANY, everyone_closed, -1);
+                continue;
+            }
+        }
+
+        ready_pos = 0;
+        ready_cnt = epoll_wait(epfd, ready, model_nprocs, block ? -1 : 0);
+        if (ready_cnt < 0) {
+            ready_cnt = 0;
+            if (errno != EINTR)
+                model_fatal("receive_any failed on %d", model_self);
+        }
+        if (ready_cnt == 0 && !block)
+            return -1;
+    }
+}
+
+static local_id pipe_recv_any(Message *msg, bool block) {
+    const Message *view;
+    local_id from = pipe_peek_any(&view, block);
+    if (from >= 0)
+        copy_out(from, view, msg);
+    return from;
+}
+
+const struct transport pipe_transport = {
+    .name = "pipe",
+    .init = pipe_init,
+    .attach = pipe_attach,
+    .detach = pipe_detach,
+    .send = pipe_send,
+    .sendv = pipe_sendv,
+    .multicast = pipe_multicast,
+    .send_batch = pipe_send_batch,
+    .recv = pipe_recv,
+    .recv_any = pipe_recv_any,
+    .peek = pipe_peek,
+    .peek_any = pipe_peek_any,
+    .release = pipe_release,
+};
@@ -0,0 +1,38 @@
+#include "model.h"
+#include "ipc.h"
+
+/*
+ * One loop for every phase of every lab.  Each message is dispatched
+ * from the channel buffer as it is, and the reactor only looks for more
+ * without waiting until every channel is empty; that is when on_idle()
+ * gets to send what it held back, and only then does the process block.
+ */
+
+static uint32_t handled_types(const Handlers *h) {
+    uint32_t types = 0;
+    for (int t = 0; t < MESSAGE_TYPES; ++t) {
+        if (h->on[t])
+            types |= MESSAGE_TYPE_BIT(t);
+    }
+    return types;
+}
+
+void run_reactor(const Handlers *h, bool (*done)(void)) {
+    uint32_t types = handled_types(h);
+    if (!types)
+        model_fatal("Process %d runs a reactor without handlers", model_self);
+
+    while (!done()) {
+        local_id from;
+        const Message *msg = h->on_idle ? try_receive_any_of_view(types, &from) : NULL;
+        if (!msg) {
+            if (h->on_idle)
+                h->on_idle();
+            msg = receive_any_of_view(types, &from);
+        }
+        if (h->on_time)
+            h->on_time(msg->s_header.s_local_time);
+        h->on[msg->s_header.s_type](from, msg);
+        release_view(msg);
+    }
+}
@@ -0,0 +1,412 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "model.h"
+
+/*
+ * One single-producer/single-consumer byte ring per ordered pair, all inside
+ * a single MAP_SHARED region created before fork().  The producer copies the
+ * whole message in before publishing `head`, so a reader that sees a header's
+ * worth of bytes always sees the whole message.  Records are 8-byte aligned
+ * and never straddle the end of the ring (a WRAP_MAGIC header sends the
+ * reader back to offset 0), which lets receive_view() hand out a pointer
+ * straight into the ring.
+ *
+ * Each receiving process owns a doorbell.  A reader spins briefly, then
+ * raises `parked`, re-checks and futex-waits; writers only pay for a
+ * FUTEX_WAKE when they observe that flag, so the steady state is
+ * syscall-free.  A writer facing a full ring parks the same way on the
+ * ring's `space` doorbell.
+ *
+ * A multicast copies the message once into a slot of the sender's pool and
+ * puts only a SHARED_MAGIC record naming that slot into each ring.  Readers
+ * are lent the slot itself and drop its reference count on release; the
+ * sender reuses a slot once the count is back to zero, and falls back to
+ * plain copies while every slot is still referenced.
+ */
+
+enum {
+    RING_SIZE = 64 * 1024,      ///< bytes per channel, power of two (as a pipe)
+    CACHE_LINE = 64,
+    SPIN_ROUNDS = 128,
+    RECORD_ALIGN = 8,
+    POOL_SLOTS = 16,            ///< multicast slots per sending process
+    WRAP_MAGIC = 0x5757,        ///< rest of the ring is padding
+    SHARED_MAGIC = 0x5353       ///< payload is the index of a pool slot
+};
+
+struct doorbell {
+    uint32_t seq;               ///< futex word, bumped on every wake
+    uint32_t parked;            ///< owner is (about to be) asleep on seq
+} __attribute__((aligned(CACHE_LINE)));
+
+struct ring {
+    uint32_t head __attribute__((aligned(CACHE_LINE)));  ///< producer side
+    uint32_t tx_closed;
+    uint32_t tail __attribute__((aligned(CACHE_LINE)));  ///< consumer side
+    uint32_t rx_closed;
+    struct doorbell space;
+    char data[RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+};
+
+struct shared_slot {
+    uint32_t refs;              ///< receivers that have not released it
+    char msg[MAX_MESSAGE_LEN] __attribute__((aligned(RECORD_ALIGN)));
+} __attribute__((aligned(CACHE_LINE)));
+
+static struct ring *rings = NULL;       ///< channel [from * nprocs + to]
+static struct doorbell *bells = NULL;   ///< one per receiving process
+static struct shared_slot *pool = NULL; ///< slot [owner * POOL_SLOTS + i]
+static int next_slot = 0;               ///< allocation cursor in own pool
+static size_t region_len = 0;
+static local_id next_any = 0;           ///< receive_any() round-robin cursor
+static int spin_rounds = 0;             ///< 0 on a single CPU: the writer can't run
+
+#define CHAN(from, to) (&rings[(from) * model_nprocs + (to)])
+
+/* ---------------- parking ---------------- */
+static void futex_wait(uint32_t *addr, uint32_t val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0);
+}
+
+static void ring_bell(struct doorbell *b) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->parked, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&b->seq, 1, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &b->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/* Returns once ready(arg) holds or the doorbell rang; callers re-check. */
+static void park(struct doorbell *b, bool (*ready)(const void *), const void *arg) {
+    for (int i = 0; i < spin_rounds; ++i) {
+        if (ready(arg))
+            return;
+    }
+    uint32_t seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&b->parked, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!ready(arg))
+        futex_wait(&b->seq, seq);
+    __atomic_store_n(&b->parked, 0, __ATOMIC_RELAXED);
+}
+
+/* ---------------- ring i/o ---------------- */
+static uint32_t record_len(const MessageHeader *h) {
+    return (sizeof(MessageHeader) + h->s_payload_len + RECORD_ALIGN - 1)
+           & ~(uint32_t) (RECORD_ALIGN - 1);
+}
+
+static void advance_tail(struct ring *r, uint32_t tail) {
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    ring_bell(&r->space);
+}
+
+static bool has_message(const void *arg) {
+    const struct ring *r = arg;
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail >= sizeof(MessageHeader)
+        || __atomic_load_n(&r->tx_closed, __ATOMIC_ACQUIRE);
+}
+
+/* Something to read, or nobody left who could ever write to us. */
+static bool any_message(const void *arg) {
+    int open = 0;
+    (void) arg;
+    for (local_id from = 0; from < model_nprocs; ++from) {
+        const struct ring *r = CHAN(from, model_self);
+        if (from == model_self)
+            continue;
+        if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail >= sizeof(MessageHeader))
+            return true;
+        if (!__atomic_load_n(&r->tx_closed, __ATOMIC_ACQUIRE))
+            ++open;
+    }
+    return open == 0;
+}
+
+struct room { struct ring *r; uint32_t len; };
+
+static bool has_room(const void *arg) {
+    const struct room *q = arg;
+    return RING_SIZE - (q->r->head - __atomic_load_n(&q->r->tail, __ATOMIC_ACQUIRE)) >= q->len
+        || __atomic_load_n(&q->r->rx_closed, __ATOMIC_ACQUIRE);
+}
+
+/* ---------------- setup ---------------- */
+static int shm_peek(local_id from, const Message **msg, bool block);
+static void shm_release(local_id from);
+
+static void shm_init(int nprocs) {
+    size_t nrings = (size_t) nprocs * nprocs;
+    region_len = nrings * sizeof(struct ring) + nprocs * sizeof(struct doorbell)
+               + (size_t) nprocs * POOL_SLOTS * sizeof(struct shared_slot);
+    void *region = mmap(NULL, region_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED)
+        model_fatal("Failed to create topology");
+    rings = region;
+    bells = (struct doorbell *) (rings + nrings);
+    pool = (struct shared_slot *) (bells + nprocs);
+}
+
+static void shm_detach(void) {
+    if (!rings)
+        return;
+    for (local_id peer = 0; peer < model_nprocs; ++peer) {
+        if (peer == model_self)
+            continue;
+        /* unread multicasts would pin the peer's pool slots forever */
+        const Message *m;
+        while (shm_peek(peer, &m, false) == RECV_OK)
+            shm_release(peer);
+
+        struct ring *out = CHAN(model_self, peer);
+        struct ring *in = CHAN(peer, model_self);
+        __atomic_store_n(&out->tx_closed, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&in->rx_closed, 1, __ATOMIC_RELEASE);
+        ring_bell(&bells[peer]);
+        ring_bell(&in->space);
+    }
+    munmap(rings, region_len);
+    rings = NULL;
+    bells = NULL;
+    pool = NULL;
+}
+
+static void shm_attach(local_id self) {
+    next_any = self + 1;
+    spin_rounds = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_ROUNDS : 0;
+    /* peers blocked on us must learn about an exit through model_fatal() too */
+    atexit(shm_detach);
+}
+
+/* ---------------- transport ---------------- */
+/* Waits for room for a record with the given header and returns where it
+ * goes; nothing is visible to the reader before publish(). */
+static char *reserve(local_id dst, const MessageHeader *hdr) {
+    struct ring *r = CHAN(model_self, dst);
+    uint32_t off = r->head & (RING_SIZE - 1);
+    uint32_t len = record_len(hdr);
+    uint32_t skip = off + len > RING_SIZE ? RING_SIZE - off : 0;
+    struct room q = { r, skip + len };
+
+    while (!has_room(&q)) {
+        ring_bell(&bells[dst]);         /* a batch may not have rung yet */
+        park(&r->space, has_room, &q);
+    }
+    if (__atomic_load_n(&r->rx_closed, __ATOMIC_ACQUIRE))
+        model_fatal("Failed to send message to %d using ring", dst);
+
+    if (skip) {
+        MessageHeader wrap = { .s_magic = WRAP_MAGIC };
+        memcpy(r->data + off, &wrap, sizeof(wrap));
+        __atomic_store_n(&r->head, r->head + skip, __ATOMIC_RELEASE);
+        off = 0;
+    }
+    return r->data + off;
+}
+
+static void publish(local_id dst, const MessageHeader *hdr, bool wake) {
+    struct ring *r = CHAN(model_self, dst);
+    __atomic_store_n(&r->head, r->head + record_len(hdr), __ATOMIC_RELEASE);
+    if (wake)
+        ring_bell(&bells[dst]);
+}
+
+static void shm_send(local_id dst, const Message *msg) {
+    char *slot = reserve(dst, &msg->s_header);
+    memcpy(slot, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len);
+    publish(dst, &msg->s_header, true);
+}
+
+static void shm_sendv(local_id dst, const MessageHeader *hdr,
+                      const struct iovec *iov, int iovcnt) {
+    char *slot = reserve(dst, hdr);
+    memcpy(slot, hdr, sizeof(*hdr));
+    slot += sizeof(*hdr);
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len)
+            memcpy(slot, iov[i].iov_base, iov[i].iov_len);
+        slot += iov[i].iov_len;
+    }
+    publish(dst, hdr, true);
+}
+
+/* Records become visible one by one, the reader is woken once. */
+static void shm_send_batch(local_id dst, const char *buf, size_t len) {
+    while (len) {
+        const MessageHeader *hdr = (const MessageHeader *) buf;
+        size_t n = sizeof(*hdr) + hdr->s_payload_len;
+        memcpy(reserve(dst, hdr), buf, n);
+        publish(dst, hdr, false);
+        buf += n;
+        len -= n;
+    }
+    ring_bell(&bells[dst]);
+}
+
+/* The pool slot a SHARED_MAGIC record from `from` refers to. */
+static struct shared_slot *shared_slot(local_id from, const MessageHeader *ref) {
+    uint32_t i;
+    if (ref->s_payload_len != sizeof(i))
+        model_fatal("msg is too long: %d", ref->s_payload_len);
+    memcpy(&i, ref + 1, sizeof(i));
+    if (i >= POOL_SLOTS)
+        model_fatal("Wrong shared slot: %u from %d, proc %d",
+                    (unsigned) i, from, model_self);
+    return &pool[from * POOL_SLOTS + i];
+}
+
+/* A slot of our own pool that no receiver holds any more, or NULL. */
+static struct shared_slot *free_slot(void) {
+    for (int k = 0; k < POOL_SLOTS; ++k) {
+        int i = (next_slot + k) % POOL_SLOTS;
+        struct shared_slot *slot = &pool[model_self * POOL_SLOTS + i];
+        if (__atomic_load_n(&slot->refs, __ATOMIC_ACQUIRE) == 0) {
+            next_slot = (i + 1) % POOL_SLOTS;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static void shm_multicast(const MessageHeader *hdr,
+                          const struct iovec *iov, int iovcnt) {
+    struct shared_slot *slot = model_nprocs > 2 ? free_slot() : NULL;
+
+    if (!slot) {
+        for (local_id dst = 0; dst < model_nprocs; ++dst) {
+            if (dst != model_self)
+                shm_sendv(dst, hdr, iov, iovcnt);
+        }
+        return;
+    }
+
+    char *p = slot->msg;
+    memcpy(p, hdr, sizeof(*hdr));
+    p += sizeof(*hdr);
+    for (int i = 0; i < iovcnt; ++i) {
+        if (iov[i].iov_len)
+            memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+    /* the release store in publish() orders the copy before any reader */
+    slot->refs = model_nprocs - 1;
+
+    uint32_t index = slot - &pool[model_self * POOL_SLOTS];
+    MessageHeader ref = { .s_magic = SHARED_MAGIC, .s_payload_len = sizeof(index) };
+    struct iovec v = { &index, sizeof(index) };
+    for (local_id dst = 0; dst < model_nprocs; ++dst) {
+        if (dst != model_self)
+            shm_sendv(dst, &ref, &v, 1);
+    }
+}
+
+static int shm_peek(local_id from, const Message **msg, bool block) {
+    struct ring *r = CHAN(from, model_self);
+
+    for (;;) {
+        bool closed = __atomic_load_n(&r->tx_closed, __ATOMIC_ACQUIRE);
+        uint32_t tail = r->tail;
+
+        if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != tail) {
+            uint32_t off = tail & (RING_SIZE - 1);
+            const Message *m = (const Message *) (r->data + off);
+            if (m->s_header.s_magic == WRAP_MAGIC) {
+                advance_tail(r, tail + RING_SIZE - off);
+                continue;
+            }
+            if (m->s_header.s_magic == SHARED_MAGIC)
+                m = (const Message *) shared_slot(from, &m->s_header)->msg;
+            if (m->s_header.s_magic != MESSAGE_MAGIC)
+                model_fatal("Wrong s_magic: %d from %d, proc %d",
+                            m->s_header.s_magic, from, model_self);
+            if (m->s_header.s_payload_len > MAX_PAYLOAD_LEN)
+                model_fatal("msg is too long: %d", m->s_header.s_payload_len);
+            *msg = m;
+            return RECV_OK;
+        }
+        if (closed)
+            return RECV_EOF;
+        if (!block)
+            return RECV_EMPTY;
+        park(&bells[model_self], has_message, r);
+    }
+}
+
+static void shm_release(local_id from) {
+    struct ring *r = CHAN(from, model_self);
+    const Message *m = (const Message *) (r->data + (r->tail & (RING_SIZE - 1)));
+    if (m->s_header.s_magic == SHARED_MAGIC)
+        __atomic_sub_fetch(&shared_slot(from, &m->s_header)->refs, 1, __ATOMIC_RELEASE);
+    advance_tail(r, r->tail + record_len(&m->s_header));
+}
+
+static local_id shm_peek_any(const Message **msg, bool block) {
+    for (;;) {
+        int open = 0;
+        for (int k = 0; k < model_nprocs; ++k) {
+            local_id from = (next_any + k) % model_nprocs;
+            if (from == model_self)
+                continue;
+            int r = shm_peek(from, msg, false);
+            if (r == RECV_OK) {
+                next_any = (from + 1) % model_nprocs;
+                return from;
+            }
+            if (r == RECV_EMPTY)
+                ++open;
+        }
+        if (open == 0)
+            model_fatal("receive_any failed on %d", model_self);
+        if (!block)
+            return -1;
+        park(&bells[model_self], any_message, NULL);
+    }
+}
+
+static void copy_out(local_id from, const Message *view, Message *msg) {
+    memcpy(msg, view, sizeof(MessageHeader) + view->s_header.s_payload_len);
+    shm_release(from);
+}
+
+static int shm_recv(local_id from, Message *msg, bool block) {
+    const Message *view;
+    int r = shm_peek(from, &view, block);
+    if (r == RECV_OK)
+        copy_out(from, view, msg);
+    return r;
+}
+
+static local_id shm_recv_any(Message *msg, bool block) {
+    const Message *view;
+    local_id from = shm_peek_any(&view, block);
+    if (from >= 0)
+        copy_out(from, view, msg);
+    return from;
+}
+
+const struct transport shm_transport = {
+    .name = "shm",
+    .init = shm_init,
+    .attach = shm_attach,
+    .detach = shm_detach,
+    .send = shm_send,
+    .sendv = shm_sendv,
+    .multicast = shm_multicast,
+    .send_batch = shm_send_batch,
+    .recv = shm_recv,
+    .recv_any = shm_recv_any,
+    .peek = shm_peek,
+    .peek_any = shm_peek_any,
+    .release = shm_release,
+};
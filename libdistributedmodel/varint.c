@@ -0,0 +1,165 @@
+#include <string.h>
+
+#include "model.h"
+#include "banking.h"
+
+/*
+ * Wire format of TRANSFER(_BATCH) and BALANCE_HISTORY payloads.  Integers
+ * are LEB128 varints, 7 bits a byte and the high bit set on all but the
+ * last; signed ones are zigzagged first so that small negatives stay short.
+ * A value that fits today's 16-bit fields takes at most 3 bytes, and most
+ * take 1 or 2, with either width of balance_t and timestamp_t.
+ */
+
+enum { MAX_VARINT_LEN = 10 };
+
+struct writer {
+    unsigned char *p, *end;
+    bool full;
+};
+
+struct reader {
+    const unsigned char *p, *end;
+};
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static void put(struct writer *w, uint64_t v) {
+    unsigned char tmp[MAX_VARINT_LEN];
+    size_t n = 0;
+    do {
+        tmp[n++] = (v & 0x7F) | (v > 0x7F ? 0x80 : 0);
+        v >>= 7;
+    } while (v);
+    if (w->full || (size_t) (w->end - w->p) < n) {
+        w->full = true;
+        return;
+    }
+    memcpy(w->p, tmp, n);
+    w->p += n;
+}
+
+static uint64_t get(struct reader *r, const char *what) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 7 * MAX_VARINT_LEN; shift += 7) {
+        if (r->p == r->end)
+            break;
+        unsigned char b = *r->p++;
+        v |= (uint64_t) (b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    model_fatal("%s: malformed varint", what);
+}
+
+/* ---------------- transfer orders ---------------- */
+static void put_order(struct writer *w, const TransferOrder *o) {
+    put(w, zigzag(o->s_src));
+    put(w, zigzag(o->s_dst));
+    put(w, zigzag(o->s_amount));
+    put(w, o->s_src_account);
+    put(w, o->s_dst_account);
+}
+
+int encode_orders(void *buf, size_t *len, const TransferOrder *orders, int n) {
+    struct writer w = { buf, (unsigned char *) buf + *len, false };
+    int k = 0;
+    for (; k < n; ++k) {
+        unsigned char *mark = w.p;
+        put_order(&w, &orders[k]);
+        if (w.full) {
+            w.p = mark;
+            break;
+        }
+    }
+    *len = w.p - (unsigned char *) buf;
+    return k;
+}
+
+int decode_orders(const void *buf, size_t len, TransferOrder *orders, int max) {
+    struct reader r = { buf, (const unsigned char *) buf + len };
+    int k = 0;
+    for (; r.p < r.end; ++k) {
+        if (k == max)
+            model_fatal("decode_orders: more than %d orders", max);
+        TransferOrder *o = &orders[k];
+        o->s_src = unzigzag(get(&r, "decode_orders"));
+        o->s_dst = unzigzag(get(&r, "decode_orders"));
+        o->s_amount = unzigzag(get(&r, "decode_orders"));
+        o->s_src_account = get(&r, "decode_orders");
+        o->s_dst_account = get(&r, "decode_orders");
+    }
+    return k;
+}
+
+/* ---------------- balance changes ---------------- */
+/* Differences are taken modulo 2^64, so they cannot overflow. */
+static int64_t diff(int64_t a, int64_t b) {
+    return (int64_t) ((uint64_t) a - (uint64_t) b);
+}
+
+static int64_t sum(int64_t a, int64_t b) {
+    return (int64_t) ((uint64_t) a + (uint64_t) b);
+}
+
+/* Chunk layout: s_id, s_end, total points, index of the first point here,
+ * then the points, each as the difference to the one before it. */
+uint32_t encode_changes(void *buf, size_t *len, BalanceChanges *c, uint32_t from) {
+    struct writer w = { buf, (unsigned char *) buf + *len, false };
+    changes_fold(c);
+    BalanceState prev = from ? c->s_points[from - 1] : (BalanceState) { 0, 0, 0 };
+
+    put(&w, zigzag(c->s_id));
+    put(&w, zigzag(c->s_end));
+    put(&w, c->s_len);
+    put(&w, from);
+    if (w.full)
+        model_fatal("encode_changes: no room for the chunk header");
+
+    uint32_t k = from;
+    for (; k < c->s_len; ++k) {
+        const BalanceState *s = &c->s_points[k];
+        unsigned char *mark = w.p;
+        put(&w, zigzag(diff(s->s_balance, prev.s_balance)));
+        put(&w, zigzag(diff(s->s_time, prev.s_time)));
+        put(&w, zigzag(diff(s->s_balance_pending_in, prev.s_balance_pending_in)));
+        if (w.full) {
+            w.p = mark;
+            break;
+        }
+        prev = *s;
+    }
+    *len = w.p - (unsigned char *) buf;
+    return k - from;
+}
+
+uint32_t decode_changes(const void *buf, size_t len, BalanceChanges *c) {
+    struct reader r = { buf, (const unsigned char *) buf + len };
+
+    c->s_id = unzigzag(get(&r, "decode_changes"));
+    c->s_end = unzigzag(get(&r, "decode_changes"));
+    uint64_t total = get(&r, "decode_changes");
+    uint64_t from = get(&r, "decode_changes");
+    if (from != c->s_len || total < from || total > UINT32_MAX)
+        model_fatal("decode_changes: got points from %llu of %llu, expected from %u",
+                    (unsigned long long) from, (unsigned long long) total, c->s_len);
+    changes_reserve(c, total);
+
+    BalanceState prev = from ? c->s_points[from - 1] : (BalanceState) { 0, 0, 0 };
+    while (r.p < r.end) {
+        if (c->s_len == total)
+            model_fatal("decode_changes: more than %llu points", (unsigned long long) total);
+        BalanceState *s = &c->s_points[c->s_len++];
+        s->s_balance = sum(prev.s_balance, unzigzag(get(&r, "decode_changes")));
+        s->s_time = sum(prev.s_time, unzigzag(get(&r, "decode_changes")));
+        s->s_balance_pending_in = sum(prev.s_balance_pending_in, unzigzag(get(&r, "decode_changes")));
+        prev = *s;
+    }
+    return total - c->s_len;
+}
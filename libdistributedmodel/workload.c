@@ -0,0 +1,233 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "model.h"
+#include "banking.h"
+
+/*
+ * Synthetic workloads for bank_operations(), chosen with
+ *
+ *   -w PATTERN[:key=value,...]
+ *
+ * uniform     source and destination uniform over all children
+ * zipf        both ends Zipf-distributed, child 1 being the hottest
+ * all-to-one  everybody pays child `to`
+ * pairs       children are matched into random fixed pairs once, each
+ *             transfer goes one way or the other within a random pair
+ *
+ * n        number of transfers (1000)
+ * amount   A or A-B, uniform in [A;B] (1)
+ * seed     generator seed (1)
+ * s        Zipf exponent (1.0)
+ * to       all-to-one target (1)
+ * accounts accounts per child, each end of a transfer is uniform over
+ *          them (1)
+ *
+ * Orders come out of a splitmix64 stream in O(1) each (O(log children)
+ * for zipf), so the generator stays far below the cost of a transfer.
+ */
+
+enum pattern { NONE, UNIFORM, ZIPF, ALL_TO_ONE, PAIRS };
+
+/* Redraws for a Zipf destination equal to the source before giving up. */
+enum { ZIPF_REDRAWS = 16 };
+
+static struct {
+    enum pattern pattern;
+    long left;                  ///< transfers still to generate
+    long amount_min, amount_max;
+    uint64_t rng;
+    double s;
+    long to;
+    long accounts;              ///< per child
+
+    local_id children;          ///< children the tables below are built for
+    double *cdf;                ///< zipf: P(child <= i + 1)
+    local_id *perm;             ///< pairs: perm[2k] and perm[2k + 1] are mates
+} w = { NONE, 1000, 1, 1, 1, 1.0, 1, 1, 0, NULL, NULL };
+
+/* ---------------- random numbers ---------------- */
+static uint64_t next_u64(void) {
+    uint64_t z = (w.rng += 0x9E3779B97F4A7C15u);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+    return z ^ (z >> 31);
+}
+
+/* Uniform in [0;bound), bound <= 2^32. */
+static uint32_t below(uint32_t bound) {
+    return (uint32_t) (((next_u64() >> 32) * bound) >> 32);
+}
+
+static double unit(void) {
+    return (next_u64() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* ---------------- parsing ---------------- */
+static long number(const char *spec, const char *key, const char *val, long lo, long hi) {
+    char *end;
+    long v = strtol(val, &end, 10);
+    if (end == val || *end || v < lo || v > hi)
+        model_fatal("Workload %s: %s must be an integer in [%ld;%ld]", spec, key, lo, hi);
+    return v;
+}
+
+void workload_init(const char *spec) {
+    static const struct { const char *name; enum pattern p; } patterns[] = {
+        { "uniform", UNIFORM }, { "zipf", ZIPF },
+        { "all-to-one", ALL_TO_ONE }, { "pairs", PAIRS },
+    };
+
+    char *copy = strdup(spec);
+    if (!copy)
+        model_fatal("workload: out of memory");
+    char *opts = strchr(copy, ':');
+    if (opts)
+        *opts++ = '\0';
+
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns); ++i)
+        if (strcmp(copy, patterns[i].name) == 0)
+            w.pattern = patterns[i].p;
+    if (w.pattern == NONE)
+        model_fatal("Workload %s: pattern is one of uniform, zipf, all-to-one, pairs", spec);
+
+    for (char *kv = opts ? strtok(opts, ",") : NULL; kv; kv = strtok(NULL, ",")) {
+        char *val = strchr(kv, '=');
+        if (!val)
+            model_fatal("Workload %s: expected key=value, got %s", spec, kv);
+        *val++ = '\0';
+
+        if (strcmp(kv, "n") == 0) {
+            w.left = number(spec, kv, val, 0, LONG_MAX);
+        } else if (strcmp(kv, "amount") == 0) {
+            char *dash = strchr(val, '-');
+            if (dash)
+                *dash++ = '\0';
+            w.amount_min = number(spec, kv, val, 0, INT16_MAX);
+            w.amount_max = dash ? number(spec, kv, dash, w.amount_min, INT16_MAX) : w.amount_min;
+        } else if (strcmp(kv, "seed") == 0) {
+            w.rng = (uint64_t) number(spec, kv, val, 0, LONG_MAX);
+        } else if (strcmp(kv, "s") == 0) {
+            char *end;
+            w.s = strtod(val, &end);
+            if (end == val || *end || !(w.s >= 0))
+                model_fatal("Workload %s: s must be a non-negative number", spec);
+        } else if (strcmp(kv, "to") == 0) {
+            w.to = number(spec, kv, val, 1, MAX_PROCESS_ID);
+        } else if (strcmp(kv, "accounts") == 0) {
+            w.accounts = number(spec, kv, val, 1, UINT32_MAX);
+        } else {
+            model_fatal("Workload %s: unknown key %s", spec, kv);
+        }
+    }
+    free(copy);
+}
+
+/* ---------------- generation ---------------- */
+static void *table(size_t n, size_t size) {
+    void *t = calloc(n, size);
+    if (!t)
+        model_fatal("workload: out of memory");
+    return t;
+}
+
+/* Builds what the pattern needs for children 1..max_id. */
+static void prepare(local_id max_id) {
+    w.children = max_id;
+    switch (w.pattern) {
+    case ZIPF: {
+        free(w.cdf);
+        w.cdf = table(max_id, sizeof(*w.cdf));
+        double sum = 0;
+        for (int i = 0; i < max_id; ++i)
+            w.cdf[i] = sum += pow(i + 1, -w.s);
+        for (int i = 0; i < max_id; ++i)
+            w.cdf[i] /= sum;
+        break;
+    }
+    case ALL_TO_ONE:
+        if (w.to > max_id)
+            model_fatal("Workload all-to-one: to=%ld, but there are %d children", w.to, max_id);
+        break;
+    case PAIRS:
+        free(w.perm);
+        w.perm = table(max_id, sizeof(*w.perm));
+        for (int i = 0; i < max_id; ++i)
+            w.perm[i] = i + 1;
+        for (int i = max_id - 1; i > 0; --i) {
+            int j = below(i + 1);
+            local_id t = w.perm[i];
+            w.perm[i] = w.perm[j];
+            w.perm[j] = t;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static local_id zipf_child(void) {
+    double u = unit();
+    int lo = 0, hi = w.children - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (w.cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo + 1;
+}
+
+/* Uniform over the children except `not`. */
+static local_id other_child(local_id not) {
+    local_id c = 1 + below(w.children - 1);
+    return c >= not ? c + 1 : c;
+}
+
+static void next_order(TransferOrder *o) {
+    switch (w.pattern) {
+    case UNIFORM:
+        o->s_src = 1 + below(w.children);
+        o->s_dst = other_child(o->s_src);
+        break;
+    case ZIPF:
+        o->s_src = zipf_child();
+        o->s_dst = zipf_child();
+        for (int i = 0; o->s_dst == o->s_src; ++i)
+            o->s_dst = i < ZIPF_REDRAWS ? zipf_child() : other_child(o->s_src);
+        break;
+    case ALL_TO_ONE:
+        o->s_dst = w.to;
+        o->s_src = other_child(o->s_dst);
+        break;
+    case PAIRS: {
+        int pair = below(w.children / 2), way = below(2);
+        o->s_src = w.perm[2 * pair + way];
+        o->s_dst = w.perm[2 * pair + 1 - way];
+        break;
+    }
+    case NONE:
+        break;
+    }
+    o->s_amount = w.amount_min + below(w.amount_max - w.amount_min + 1);
+    o->s_src_account = w.accounts > 1 ? below(w.accounts) : 0;
+    o->s_dst_account = w.accounts > 1 ? below(w.accounts) : 0;
+}
+
+int workload_orders(local_id max_id, TransferOrder *orders, int n) {
+    if (w.pattern == NONE || max_id < 2)
+        return 0;
+    if (w.children != max_id)
+        prepare(max_id);
+
+    int k = 0;
+    for (; k < n && w.left > 0; ++k, --w.left)
+        next_order(&orders[k]);
+    return k;
+}
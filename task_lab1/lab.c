@@ -4,25 +4,16 @@
 #include <sys/types.h>
 
 #include "message.h"
+#include "ipc.h"
 #include "log.h"
 #include "process.h"
 
 /* ================= PARENT ================= */
 void parent_work(int count_nodes)
 {
-    int children_total = count_nodes - 1;
-
-    /* Receive STARTED from all children */
-    for (int i = 1; i <= children_total; i++) {
-        Message msg;
-        receive(i, &msg);  // 每个子进程都要收一次
-    }
-
-    /* Receive DONE from all children */
-    for (int i = 1; i <= children_total; i++) {
-        Message msg;
-        receive(i, &msg);
-    }
+    /* Wait for STARTED, then DONE, of all children */
+    barrier(STARTED, 0, NULL, 0);
+    barrier(DONE, 0, NULL, 0);
 
     /* 父进程不打印任何日志 */
 }
@@ -31,7 +22,6 @@ void parent_work(int count_nodes)
 void child_work(struct child_arguments args)
 {
     local_id self_id = args.self_id;
-    int count_nodes = args.count_nodes;
     pid_t self_pid = getpid();
     pid_t parent_pid = getppid();
 
@@ -39,25 +29,19 @@ void child_work(struct child_arguments args)
     {
         char payload[BUF_SIZE];
         snprintf(payload, sizeof(payload),
-                 log_started_fmt, 0, self_id, self_pid, parent_pid, args.balance);
-
-        Message msg;
-        fill_message(&msg, STARTED, 0, payload, (size_t)strlen(payload));
-        send_multicast(&msg);
+                 log_started_fmt, (timestamp_t) 0, self_id, self_pid, parent_pid,
+                 (balance_t) args.balance);
 
         shared_logger(payload);
+
+        /* The log line goes out as the STARTED message */
+        barrier(STARTED, 0, payload, strlen(payload));
     }
 
-    /* Receive STARTED from all other children */
+    /* All other children have STARTED */
     {
-        for (int i = 1; i < count_nodes; i++) {
-            if (i == self_id) continue; // 跳过自己
-            Message msg;
-            receive(i, &msg);  // 指定来源
-        }
-
         char buf[BUF_SIZE];
-        snprintf(buf, sizeof(buf), log_received_all_started_fmt, 0, self_id);
+        snprintf(buf, sizeof(buf), log_received_all_started_fmt, (timestamp_t) 0, self_id);
         shared_logger(buf);
     }
 
@@ -68,25 +52,17 @@ void child_work(struct child_arguments args)
     {
         char payload[BUF_SIZE];
         snprintf(payload, sizeof(payload),
-                 log_done_fmt, 0, self_id, args.balance);
-
-        Message msg;
-        fill_message(&msg, DONE, 0, payload, (size_t)strlen(payload));
-        send_multicast(&msg);
+                 log_done_fmt, (timestamp_t) 0, self_id, (balance_t) args.balance);
 
         shared_logger(payload);
+
+        barrier(DONE, 0, payload, strlen(payload));
     }
 
-    /* Receive DONE from all other children */
+    /* All other children are DONE */
     {
-        for (int i = 1; i < count_nodes; i++) {
-            if (i == self_id) continue;
-            Message msg;
-            receive(i, &msg);
-        }
-
         char buf[BUF_SIZE];
-        snprintf(buf, sizeof(buf), log_received_all_done_fmt, 0, self_id);
+        snprintf(buf, sizeof(buf), log_received_all_done_fmt, (timestamp_t) 0, self_id);
         shared_logger(buf);
     }
 }
@@ -9,28 +9,33 @@
 #ifndef ITMO_HDU_DISTRIBUTED_SYSTEMS_LOG_H
 #define ITMO_HDU_DISTRIBUTED_SYSTEMS_LOG_H
 
+#include "banking.h"
+
+/* Timestamps and balances are converted with PRI_TIME and PRI_BALANCE, so
+ * pass them as timestamp_t and balance_t. */
+
 /*
  * <timestamp> process <local id> (pid <PID>, paranet <PID>) has STARTED with balance $<id>
  */
 static const char * const log_started_fmt =
-    "%d: process %1d (pid %5d, parent %5d) has STARTED with balance $%2d\n";
+    "%" PRI_TIME ": process %1d (pid %5d, parent %5d) has STARTED with balance $%2" PRI_BALANCE "\n";
 
 static const char * const log_received_all_started_fmt =
-    "%d: process %1d received all STARTED messages\n";
+    "%" PRI_TIME ": process %1d received all STARTED messages\n";
 
 static const char * const log_done_fmt =
-    "%d: process %1d has DONE with balance $%2d\n";
+    "%" PRI_TIME ": process %1d has DONE with balance $%2" PRI_BALANCE "\n";
 
 static const char * const log_received_all_done_fmt =
-    "%d: process %1d received all DONE messages\n";
+    "%" PRI_TIME ": process %1d received all DONE messages\n";
 
 /* For banking system laboratory works */
 static const char * const log_transfer_out_fmt =
-    "%d: process %1d transferred $%2d to process %1d\n";
+    "%" PRI_TIME ": process %1d transferred $%2" PRI_BALANCE " to process %1d\n";
 
 /* For banking system laboratory works */
 static const char * const log_transfer_in_fmt =
-    "%d: process %1d received $%2d from process %1d\n";
+    "%" PRI_TIME ": process %1d received $%2" PRI_BALANCE " from process %1d\n";
 
 /* For mutual exclusion laboratory works
  * Iteration enumerated starting from 1, i.e.
@@ -1,9 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
 
 #include "message.h"
+#include "ipc.h"
 #include "log.h"
 #include "process.h"
 #include "banking.h"
@@ -15,64 +17,418 @@
  *   Source -> Destination (TRANSFER)
  *   Destination -> Parent (ACK)
  *
+ * With TRANSFER_BATCH=<k> the parent packs up to k orders for the same
+ * source into one TRANSFER_BATCH; the source forwards one message per
+ * destination.
+ *
+ * With ACK_EVERY=<k> (or with batches) destinations answer with cumulative
+ * ACKs of TransferAcks instead, after k transfers or as soon as nothing
+ * else is waiting to be read.
+ *
+ * With PEER_TRANSFERS=<n> in the environment every child starts n
+ * transfers of its own instead:
+ *   Source -> Destination (TRANSFER)
+ *   Destination -> Source (ACK)
+ *   Source -> Parent (ACK with the number of transfers it completed)
+ *
  *  After all transfers:
  *   Parent sends STOP
  *   Children exchange DONE
- *   Each child sends BALANCE_HISTORY to Parent
+ *   Children gather BALANCE_HISTORY to Parent along a binomial tree
  */
 
 
 
-/*---------------------------------------------------------------
- * Helper function: Wait for and receive message of given type
- * from all child processes (1..count_nodes-1)
- *--------------------------------------------------------------*/
-static void wait_for_all(MessageType type, int count_nodes) {
-    Message msg;
+// Parent and children, known once parent_work()/child_work() start
+static int node_count = 0;
+
+
+
+
+
+// Transfers each child starts by itself, 0 when the parent drives them
+static int peer_transfers(void)
+{
+    const char *env = getenv("PEER_TRANSFERS");
+    return env && atoi(env) > 0 ? atoi(env) : 0;
+}
+
+// Children report once all the transfers they started are ACKed
+static void wait_peer_transfers(int count_nodes)
+{
+    int children = count_nodes - 1;
+    long expected = children > 1 ? (long) children * peer_transfers() : 0;
+    long completed = 0;
+
     for (int i = 1; i < count_nodes; ++i) {
-        receive(i, &msg);
+        const Message *msg;
+        while ((msg = receive_view(i))->s_header.s_type != ACK)
+            release_view(msg);
+        uint32_t count;
+        memcpy(&count, msg->s_payload, sizeof(count));
+        completed += count;
+        release_view(msg);
     }
+    if (completed != expected)
+        fprintf(stderr, "Children completed %ld transfers out of %ld\n", completed, expected);
+}
+
+
+// print_history() shows the first 255 ticks, longer runs also get their end
+static void print_long_run(const HistoryIndex *index)
+{
+    timestamp_t end = index->s_total.s_end - 1;
+    if (end < UINT8_MAX)
+        return;
+    printf("At time %" PRI_TIME ": total $%" PRI_BALANCE ", at most $%" PRI_BALANCE " in flight since 0\n",
+           end, total_at(index, end), max_in_flight(index, 0, end));
+}
+
+
+// Histories reach the parent along the gather() tree, parts of different children interleaved
+static BalanceChanges *gathered = NULL;
+
+static void take_history(local_id origin, const void *part, size_t len)
+{
+    decode_changes(part, len, &gathered[origin - 1]);
 }
 
 
 
 void parent_work(int count_nodes)
 {
-    AllHistory all_history;
-    all_history.s_history_len = count_nodes - 1;
+    // Sized for the actual number of children, only once it is needed
+    AllHistory *all_history = NULL;
+    node_count = count_nodes;
 
-    Message msg;
     // wait for all children STARTED
-    wait_for_all(STARTED, count_nodes);
+    barrier(STARTED, get_physical_time(), NULL, 0);
 
 
-    bank_operations(count_nodes - 1);
+    if (peer_transfers())
+        wait_peer_transfers(count_nodes);
+    else
+        bank_operations(count_nodes - 1);
 
 
     {
-        Message stop_msg;
         timestamp_t now = get_physical_time();
-        fill_message(&stop_msg, STOP, now, NULL, 0);
-        send_multicast(&stop_msg);
+        send_multicast_iov(STOP, now, NULL, 0);
     }
 
     //Wait for all children DONE
-    wait_for_all(DONE, count_nodes);
+    barrier(DONE, get_physical_time(), NULL, 0);
 
 
     //Collect BALANCE_HISTORY from all children
-    for (int i = 1; i < count_nodes; ++i) {
-        receive(i, &msg);
-        if (msg.s_header.s_type == BALANCE_HISTORY) {
-            BalanceHistory *h = (BalanceHistory *) msg.s_payload;
-            memcpy(&all_history.s_history[i - 1], h, msg.s_header.s_payload_len);
-        }
+    all_history = malloc(all_history_size(count_nodes - 1));
+    if (!all_history) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
     }
+    all_history->s_history_len = count_nodes - 1;
+    BalanceChanges *changes = calloc(count_nodes - 1, sizeof(*changes));
+    if (!changes) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    gathered = changes;
+    gather(PARENT_ID, BALANCE_HISTORY, get_physical_time(), NULL, take_history);
+    for (int i = 1; i < count_nodes; ++i)
+        changes_expand(&changes[i - 1], &all_history->s_history[i - 1]);
+    HistoryIndex index;
+    history_index_build(&index, changes, count_nodes - 1);
 
     //Print all histories to stdout
-    print_history(&all_history);
+    print_history(all_history);
+    free(all_history);
+    print_long_run(&index);
+    history_index_free(&index);
+}
+
+
+
+
+// Transfers started here whose ACK has not come back yet
+enum { DEFAULT_TRANSFER_WINDOW = 16 };
+static int in_flight = 0;
+static int window = 0;
+
+static int transfer_window(void)
+{
+    if (window == 0) {
+        const char *env = getenv("TRANSFER_WINDOW");
+        window = env && atoi(env) > 0 ? atoi(env) : DEFAULT_TRANSFER_WINDOW;
+    }
+    return window;
 }
 
+// Orders per TRANSFER_BATCH, 1 sends every order as a plain TRANSFER
+static int batch_size(void)
+{
+    const char *env = getenv("TRANSFER_BATCH");
+    int n = env ? atoi(env) : 1;
+    return n < 1 ? 1 : n > MAX_TRANSFER_BATCH ? MAX_TRANSFER_BATCH : n;
+}
+
+// Orders that do not fit one message carry on in the next
+static void send_orders(local_id dst, const TransferOrder *orders, int n, timestamp_t t)
+{
+    char buf[MAX_PAYLOAD_LEN];
+    while (n > 0) {
+        size_t len = sizeof(buf);
+        int k = encode_orders(buf, &len, orders, n);
+        struct iovec payload = { buf, len };
+        send_iov(dst, k == 1 ? TRANSFER : TRANSFER_BATCH, t, &payload, 1);
+        orders += k;
+        n -= k;
+    }
+}
+
+// Transfers per cumulative ACK
+static int ack_every(void)
+{
+    const char *env = getenv("ACK_EVERY");
+    return env && atoi(env) > 0 ? atoi(env) : 1;
+}
+
+// Otherwise every transfer gets its own empty ACK
+static int cumulative_acks(void)
+{
+    return ack_every() > 1 || batch_size() > 1;
+}
+
+static void *alloc_table(size_t n, size_t size)
+{
+    void *table = calloc(n, size);
+    if (!table) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+// Initiator side: transfers confirmed so far, [src * node_count + dst]
+static uint16_t *confirmed = NULL;
+
+// Returns the number of transfers the ACK from dst retires
+static int confirm(local_id dst, const Message *ack)
+{
+    if (!ack->s_header.s_payload_len)
+        return 1;
+    if (!confirmed)
+        confirmed = alloc_table((size_t) node_count * node_count, sizeof(*confirmed));
+
+    const TransferAck *acks = (const TransferAck *) ack->s_payload;
+    int n = ack->s_header.s_payload_len / sizeof(TransferAck);
+    int retired = 0;
+    for (int i = 0; i < n; ++i) {
+        uint16_t *upto = &confirmed[acks[i].s_src * node_count + dst];
+        retired += (uint16_t) (acks[i].s_upto - *upto);
+        *upto = acks[i].s_upto;
+    }
+    return retired;
+}
+
+// Destination side: transfers booked and reported per source, the sources
+// booked from since the last ACK, and how many transfers that is
+static uint16_t *booked = NULL;
+static uint16_t *reported = NULL;
+static local_id *unreported = NULL;
+static int nunreported = 0;
+static int unacked = 0;
+
+// Peer-initiated transfers are acknowledged to their source, the rest to the parent
+static void send_acks(timestamp_t now)
+{
+    TransferAck acks[MAX_PROCESS_ID];
+    int n = 0;
+    for (int i = 0; i < nunreported; ++i) {
+        local_id src = unreported[i];
+        TransferAck ack = { src, booked[src] };
+        reported[src] = booked[src];
+
+        if (peer_transfers()) {
+            struct iovec payload = { &ack, sizeof(ack) };
+            send_iov(src, ACK, now, &payload, 1);
+        } else {
+            acks[n++] = ack;
+        }
+    }
+    if (n) {
+        struct iovec payload = { acks, n * sizeof(TransferAck) };
+        send_iov(PARENT_ID, ACK, now, &payload, 1);
+    }
+    nunreported = 0;
+    unacked = 0;
+}
+
+static void book(local_id src, int n, timestamp_t now)
+{
+    if (!booked) {
+        booked = alloc_table(node_count, sizeof(*booked));
+        reported = alloc_table(node_count, sizeof(*reported));
+        unreported = alloc_table(node_count, sizeof(*unreported));
+    }
+    if (booked[src] == reported[src])
+        unreported[nunreported++] = src;
+    booked[src] += n;
+    unacked += n;
+    if (unacked >= ack_every())
+        send_acks(now);
+}
+
+// Accounts of this child; the balance it reports is their sum
+static AccountTable accounts;
+
+// This process is the SOURCE: take the money and pass the orders on
+static void send_money(const TransferOrder *orders, int n, balance_t *balance, BalanceChanges *history)
+{
+    timestamp_t now = get_physical_time();
+    char buf[BUF_SIZE];
+    for (int i = 0; i < n; ++i) {
+        *account_balance(&accounts, orders[i].s_src_account) -= orders[i].s_amount;
+        *balance -= orders[i].s_amount;
+
+        // Log money out
+        snprintf(buf, sizeof(buf), log_transfer_out_fmt, now, orders[i].s_src, orders[i].s_amount, orders[i].s_dst);
+        shared_logger(buf);
+    }
+    changes_set_balance(history, now, *balance);
+
+    // Orders for the same destination travel on in one message
+    TransferOrder group[MAX_TRANSFER_BATCH];
+    char taken[MAX_TRANSFER_BATCH] = {0};
+    for (int i = 0; i < n; ++i) {
+        if (taken[i])
+            continue;
+        int len = 0;
+        for (int j = i; j < n; ++j) {
+            if (!taken[j] && orders[j].s_dst == orders[i].s_dst) {
+                group[len++] = orders[j];
+                taken[j] = 1;
+            }
+        }
+        send_orders(orders[i].s_dst, group, len, now);
+    }
+}
+
+// This process is the DESTINATION: book the money and ACK it
+static void receive_money(const TransferOrder *orders, int n, balance_t *balance, BalanceChanges *history,
+                          local_id ack_to)
+{
+    timestamp_t now = get_physical_time();
+    char buf[BUF_SIZE];
+    for (int i = 0; i < n; ++i) {
+        *account_balance(&accounts, orders[i].s_dst_account) += orders[i].s_amount;
+        *balance += orders[i].s_amount;
+
+        // Log money in
+        snprintf(buf, sizeof(buf), log_transfer_in_fmt, now, orders[i].s_dst, orders[i].s_amount, orders[i].s_src);
+        shared_logger(buf);
+    }
+    changes_set_balance(history, now, *balance);
+
+    if (cumulative_acks())
+        book(orders->s_src, n, now);
+    else
+        send_iov(ack_to, ACK, now, NULL, 0);
+}
+
+// The k-th transfer a child starts by itself goes to the k-th other child
+static local_id peer_destination(local_id self_id, int k, int children)
+{
+    return 1 + (self_id + k % (children - 1)) % children;
+}
+
+
+// What the handlers of the main loop share
+static struct {
+    local_id self_id;
+    balance_t balance;
+    BalanceChanges history;
+    int peer_total, peer_sent, peer_reported;
+    int active;
+} child;
+
+// Start our own transfers as far as the window allows, report once all of them are ACKed
+static void start_peer_transfers(void)
+{
+    int children = node_count - 1;
+    while (child.peer_sent < child.peer_total && in_flight < transfer_window()) {
+        TransferOrder orders[MAX_TRANSFER_BATCH];
+        int n = 0;
+        while (n < batch_size() && child.peer_sent < child.peer_total && in_flight + n < transfer_window()) {
+            TransferOrder order = { child.self_id, peer_destination(child.self_id, child.peer_sent++, children), 1 };
+            orders[n++] = order;
+        }
+        send_money(orders, n, &child.balance, &child.history);
+        in_flight += n;
+    }
+    if (!child.peer_reported && child.peer_sent == child.peer_total && in_flight == 0) {
+        uint32_t count = child.peer_sent;
+        struct iovec payload = { &count, sizeof(count) };
+        send_iov(PARENT_ID, ACK, get_physical_time(), &payload, 1);
+        child.peer_reported = 1;
+    }
+}
+
+static void on_transfer(local_id from, const Message *msg)
+{
+    // Every order in a batch has the same source and, once forwarded, destination
+    TransferOrder orders[MAX_TRANSFER_BATCH];
+    int n = decode_orders(msg->s_payload, msg->s_header.s_payload_len, orders, MAX_TRANSFER_BATCH);
+
+    if (orders->s_src == child.self_id)
+        send_money(orders, n, &child.balance, &child.history);
+    else if (orders->s_dst == child.self_id)
+        receive_money(orders, n, &child.balance, &child.history, peer_transfers() ? from : PARENT_ID);
+}
+
+static void on_ack(local_id from, const Message *msg)
+{
+    in_flight -= confirm(from, msg);
+    start_peer_transfers();
+}
+
+static void on_stop(local_id from, const Message *msg)
+{
+    child.active = 0;
+}
+
+// ACKs are held back only while there is more to read
+static void on_idle(void)
+{
+    if (unacked)
+        send_acks(get_physical_time());
+}
+
+static bool stopped(void)
+{
+    return !child.active;
+}
+
+// Peers that saw STOP before us may already have sent their DONE, it waits in its mailbox
+static const Handlers main_loop = {
+    .on = {
+        [TRANSFER] = on_transfer,
+        [TRANSFER_BATCH] = on_transfer,
+        [ACK] = on_ack,
+        [STOP] = on_stop,
+    },
+    .on_idle = on_idle,
+};
+
+// Our history for gather(), as many parts as the points take
+static uint32_t history_sent = 0;
+
+static size_t next_history_part(void *buf, size_t cap)
+{
+    if (history_sent == child.history.s_len)
+        return 0;
+    history_sent += encode_changes(buf, &cap, &child.history, history_sent);
+    return cap;
+}
 
 
 
@@ -81,16 +437,14 @@ void child_work(struct child_arguments args)
     
     local_id self_id   = args.self_id;
     int count_nodes    = args.count_nodes;
-    balance_t balance  = args.balance;
+    node_count = count_nodes;
+    child.self_id = self_id;
+    child.balance = args.balance;
+    *account_balance(&accounts, 0) = child.balance;
 
-    // Prepare BalanceHistory structure
-    BalanceHistory history;
-    history.s_id = self_id;
-    history.s_history_len = 1;
-    memset(history.s_history, 0, sizeof(history.s_history));
-    history.s_history[0].s_balance = balance;
-    history.s_history[0].s_time = get_physical_time();
-    history.s_history[0].s_balance_pending_in = 0;
+    // Balance history, one point per change
+    child.history.s_id = self_id;
+    changes_set_balance(&child.history, 0, child.balance);
 
     // System PIDs for logs
     pid_t self_pid   = getpid();
@@ -100,21 +454,13 @@ void child_work(struct child_arguments args)
     // PHASE 1: Send STARTED, wait for all others' STARTED
 
     {
-        Message msg;
         timestamp_t t = get_physical_time();
         char buffer[BUF_SIZE];
-        snprintf(buffer, sizeof(buffer), log_started_fmt, t, self_id, self_pid, parent_pid, balance);
+        snprintf(buffer, sizeof(buffer), log_started_fmt, t, self_id, self_pid, parent_pid, child.balance);
         shared_logger(buffer);
 
-        fill_message(&msg, STARTED, t, buffer, strlen(buffer));
-        send_multicast(&msg);
-
-        // Wait for STARTED from all others
-        Message recv_msg;
-        for (int i = 1; i < count_nodes; ++i) {
-            if (i == self_id) continue;
-            receive(i, &recv_msg);
-        }
+        // The log line goes on the wire as is, then wait for STARTED from all others
+        barrier(STARTED, t, buffer, strlen(buffer));
 
         timestamp_t now = get_physical_time();
         snprintf(buffer, sizeof(buffer), log_received_all_started_fmt, now, self_id);
@@ -123,70 +469,12 @@ void child_work(struct child_arguments args)
 
     
     // PHASE 2: Main work loop – handle TRANSFER and STOP
-    
-    int active = 1;
-    while (active) {
-        Message msg;
-        local_id from = receive_any(&msg);
-        (void) from;
-        MessageHeader *h = &msg.s_header;
-
-        switch (h->s_type) {
-        case TRANSFER: {
-            TransferOrder *order = (TransferOrder *) msg.s_payload;
-
-            timestamp_t now = get_physical_time();
-
-            if (order->s_src == self_id) {
-                // This process is the SOURCE
-                balance -= order->s_amount;
-                history.s_history[now].s_balance = balance;
-                history.s_history[now].s_time = now;
-                history.s_history[now].s_balance_pending_in = 0;
-                history.s_history_len = now + 1;
-
-                // Log money out
-                char buf[BUF_SIZE];
-                snprintf(buf, sizeof(buf), log_transfer_out_fmt, now, self_id, order->s_amount, order->s_dst);
-                shared_logger(buf);
-
-                // Forward TRANSFER to destination
-                Message transfer_msg;
-                fill_message(&transfer_msg, TRANSFER, now, order, sizeof(TransferOrder));
-                send(order->s_dst, &transfer_msg);
-
-            } else if (order->s_dst == self_id) {
-                // This process is the DESTINATION
-                balance += order->s_amount;
-                history.s_history[now].s_balance = balance;
-                history.s_history[now].s_time = now;
-                history.s_history[now].s_balance_pending_in = 0;
-                history.s_history_len = now + 1;
-
-                // Log money in
-                char buf[BUF_SIZE];
-                snprintf(buf, sizeof(buf), log_transfer_in_fmt, now, self_id, order->s_amount, order->s_src);
-                shared_logger(buf);
-
-                // Send ACK to parent
-                Message ack_msg;
-                fill_message(&ack_msg, ACK, now, NULL, 0);
-                send(PARENT_ID, &ack_msg);
-            }
-            break;
-        }
-
-        case STOP:
-            active = 0;
-            break;
 
-        case DONE:
-            break;
-
-        default:
-            break;
-        }
-    }
+    child.peer_total = count_nodes > 2 ? peer_transfers() : 0;
+    child.peer_reported = !peer_transfers();
+    child.active = 1;
+    start_peer_transfers();
+    run_reactor(&main_loop, stopped);
 
 
     // PHASE 3: Termination – send DONE to all, wait for all DONE
@@ -195,30 +483,20 @@ void child_work(struct child_arguments args)
         timestamp_t now = get_physical_time();
 
         char buf[BUF_SIZE];
-        snprintf(buf, sizeof(buf), log_done_fmt, now, self_id, balance);
+        snprintf(buf, sizeof(buf), log_done_fmt, now, self_id, child.balance);
         shared_logger(buf);
 
-        Message done_msg;
-        fill_message(&done_msg, DONE, now, buf, strlen(buf));
-        send_multicast(&done_msg);
-
         // Wait for DONE from all others
-        Message msg;
-        for (int i = 1; i < count_nodes; ++i) {
-            if (i == self_id) continue;
-            receive(i, &msg);
-        }
+        barrier(DONE, now, buf, strlen(buf));
+        account_table_free(&accounts);
 
         now = get_physical_time();
         snprintf(buf, sizeof(buf), log_received_all_done_fmt, now, self_id);
         shared_logger(buf);
 
-        // Prepare and send BALANCE_HISTORY to parent
-        Message bh_msg;
-        timestamp_t t = get_physical_time();
-        uint16_t psize = 2 * sizeof(uint8_t) + history.s_history_len * sizeof(BalanceState);
-        fill_message(&bh_msg, BALANCE_HISTORY, t, &history, psize);
-        send(PARENT_ID, &bh_msg);
+        // Send BALANCE_HISTORY towards the parent, in as many messages as it takes
+        gather(PARENT_ID, BALANCE_HISTORY, get_physical_time(), next_history_part, NULL);
+        changes_free(&child.history);
     }
 }
 
@@ -227,36 +505,164 @@ void child_work(struct child_arguments args)
 
 // Implementation of transfer() - used by parent process
 
-void transfer(local_id src, local_id dst, balance_t amount)
+// Orders transfer_async() holds back, one batch per source
+struct batch {
+    int len;
+    int listed;             // already in open_batches
+    TransferOrder orders[MAX_TRANSFER_BATCH];
+};
+static struct batch *batches[MAX_PROCESS_ID + 1];
+static local_id open_batches[MAX_PROCESS_ID + 1];
+static int nopen = 0;
+
+static void flush_batch(local_id src)
+{
+    struct batch *b = batches[src];
+    if (b->len) {
+        send_orders(src, b->orders, b->len, get_physical_time());
+        b->len = 0;
+    }
+}
+
+static void flush_batches(void)
+{
+    for (int i = 0; i < nopen; ++i) {
+        flush_batch(open_batches[i]);
+        batches[open_batches[i]]->listed = 0;
+    }
+    nopen = 0;
+}
+
+// Destinations ACK in any order, each ACK retires the orders of one message.
+// Returns the destination that sent it.
+static local_id wait_ack(void)
+{
+    while (1) {
+        local_id from;
+        const Message *ack = receive_any_view(&from);
+        int16_t type = ack->s_header.s_type;
+        if (type == ACK)
+            in_flight -= confirm(from, ack);
+        release_view(ack);
+        if (type == ACK)
+            return from;
+    }
+}
+
+void transfer_async(local_id src, local_id dst, balance_t amount)
 {
+    while (in_flight >= transfer_window()) {
+        flush_batches();
+        wait_ack();
+    }
+
+    struct batch *b = batches[src];
+    if (!b && !(b = batches[src] = calloc(1, sizeof(*b)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    if (!b->listed) {
+        open_batches[nopen++] = src;
+        b->listed = 1;
+    }
+
+    // The source forwards the orders to their destinations, which ACK to us
     TransferOrder order = {src, dst, amount};
+    b->orders[b->len++] = order;
+    ++in_flight;
+    if (b->len == batch_size())
+        flush_batch(src);
+}
 
-    // 1. Prepare TRANSFER message for source
-    Message msg;
-    timestamp_t t = get_physical_time();
-    fill_message(&msg, TRANSFER, t, &order, sizeof(TransferOrder));
+void wait_transfers(void)
+{
+    flush_batches();
+    while (in_flight > 0)
+        wait_ack();
+}
 
-    // 2. Send it to source process
-    send(src, &msg);
+void transfer(local_id src, local_id dst, balance_t amount)
+{
+    transfer_async(src, dst, amount);
+    wait_transfers();
+}
 
-    // 3. Wait for ACK from destination
-    Message ack;
-    while (1) {
-        receive_any(&ack);
-        if (ack.s_header.s_type == ACK)
-            break;
+// Orders transfer_orders() looks at past the oldest one still waiting, per slot of the window
+enum { LOOKAHEAD_PER_SLOT = 4 };
+
+void transfer_orders(const TransferOrder *orders, int n)
+{
+    // Accounts with a transfer in flight map to the other end of it (0 when idle);
+    // claimed[] holds the pass in which a waiting order reserved the account
+    local_id *partner = alloc_table(node_count, sizeof(*partner));
+    int *claimed = alloc_table(node_count, sizeof(*claimed));
+    char *issued = alloc_table(n ? n : 1, 1);
+    int lookahead = LOOKAHEAD_PER_SLOT * transfer_window();
+
+    wait_transfers();
+    for (int head = 0, pass = 1; head < n; ++pass) {
+        for (int i = head, seen = 0; i < n && seen < lookahead && in_flight < transfer_window(); ++i) {
+            if (issued[i])
+                continue;
+            ++seen;
+
+            local_id src = orders[i].s_src, dst = orders[i].s_dst;
+            if (partner[src] || partner[dst] || claimed[src] == pass || claimed[dst] == pass) {
+                // Later orders touching these accounts wait behind this one
+                claimed[src] = claimed[dst] = pass;
+                continue;
+            }
+            partner[src] = dst;
+            partner[dst] = src;
+            issued[i] = 1;
+            transfer_async(src, dst, orders[i].s_amount);
+        }
+        while (head < n && issued[head])
+            ++head;
+
+        // Every account is in at most one transfer, so the ACK names it
+        if (in_flight) {
+            flush_batches();
+            local_id dst = wait_ack();
+            partner[partner[dst]] = 0;
+            partner[dst] = 0;
+        }
     }
+    wait_transfers();
+
+    free(partner);
+    free(claimed);
+    free(issued);
 }
 
 
 
 
+// Orders taken from a -w workload at a time
+enum { WORKLOAD_CHUNK = 4096 };
+
 __attribute__((weak)) void bank_operations(local_id max_id)
 {
+    // A workload given with -w replaces the ring
+    static TransferOrder chunk[WORKLOAD_CHUNK];
+    int n = workload_orders(max_id, chunk, WORKLOAD_CHUNK);
+    if (n > 0) {
+        do {
+            transfer_orders(chunk, n);
+        } while ((n = workload_orders(max_id, chunk, WORKLOAD_CHUNK)) > 0);
+        return;
+    }
+
+    TransferOrder *orders = alloc_table(max_id, sizeof(*orders));
+    n = 0;
     for (int i = 1; i < max_id; ++i) {
-        transfer(i, i + 1, i);
+        TransferOrder order = { i, i + 1, i };
+        orders[n++] = order;
     }
     if (max_id > 1) {
-        transfer(max_id, 1, 1);
+        TransferOrder order = { max_id, 1, 1 };
+        orders[n++] = order;
     }
+    transfer_orders(orders, n);
+    free(orders);
 }
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 
 #include "message.h"
+#include "ipc.h"
 #include "log.h"
 #include "process.h"
 #include "banking.h"
@@ -12,192 +13,587 @@
 /* ---------------- Lamport clock ---------------- */
 static timestamp_t ltime = 0;
 static inline timestamp_t get_lamport_time(void)        { return ltime; }
-static inline void inc_lamport_time(void)               { ++ltime; }
-static inline void sync_lamport_time(timestamp_t other) { ltime = (ltime > other ? ltime : other) + 1; }
+/* long runs outlast timestamp_t: the clock then stays at its maximum */
+static inline timestamp_t next_lamport_time(void)       { return ltime < TIMESTAMP_MAX ? ltime + 1 : ltime; }
+static inline void inc_lamport_time(void)               { ltime = next_lamport_time(); }
+static inline void sync_lamport_time(timestamp_t other) { ltime = ltime > other ? ltime : other; inc_lamport_time(); }
+
+/* Parent and children, known once parent_work()/child_work() start */
+static int node_count = 0;
 
 /* ---------------- utility ---------------- */
-static void fill_msg(Message *m, MessageType t, const void *payload, size_t len) {
+/* Tick the clock and send the payload straight from the caller's buffer. */
+static void send_msg(local_id dst, MessageType t, const void *payload, size_t len) {
+    struct iovec v = { (void *)payload, len };
+    inc_lamport_time();
+    send_iov(dst, t, get_lamport_time(), &v, len ? 1 : 0);
+}
+
+static void multicast_msg(MessageType t, const void *payload, size_t len) {
+    struct iovec v = { (void *)payload, len };
     inc_lamport_time();
-    m->s_header.s_magic = MESSAGE_MAGIC;
-    m->s_header.s_type  = t;
-    m->s_header.s_payload_len = len;
-    m->s_header.s_local_time  = get_lamport_time();
-    if (len && payload) memcpy(m->s_payload, payload, len);
+    send_multicast_iov(t, get_lamport_time(), &v, len ? 1 : 0);
+}
+
+/* Entering the barrier is one event, we leave it after the latest time
+ * anybody entered with. */
+static void sync_phase(MessageType phase, const void *payload, size_t len) {
+    inc_lamport_time();
+    sync_lamport_time(barrier(phase, get_lamport_time(), payload, len));
+}
+
+/* ---------------- peer-initiated transfers ---------------- */
+/* PEER_TRANSFERS=<n>: every child starts n transfers of its own, the
+ * destination ACKs to the source, and the source reports its completed
+ * count to the parent once all of them are ACKed.  0 means the parent
+ * drives transfers through bank_operations(). */
+static int peer_transfers(void) {
+    const char *env = getenv("PEER_TRANSFERS");
+    return env && atoi(env) > 0 ? atoi(env) : 0;
+}
+
+/* The k-th transfer a child starts goes to the k-th other child. */
+static local_id peer_destination(local_id self, int k, int children) {
+    return 1 + (self + k % (children - 1)) % children;
 }
 
-static void wait_all(MessageType type, int nproc, local_id self) {
-    Message msg;
+static void wait_peer_transfers(int nproc) {
+    int children = nproc - 1;
+    long expected = children > 1 ? (long)children * peer_transfers() : 0;
+    long completed = 0;
     for (int i = 1; i < nproc; ++i) {
-        if (i == self) continue;
-        do { receive(i, &msg); } while (msg.s_header.s_type != type);
-        sync_lamport_time(msg.s_header.s_local_time);
+        const Message *msg = receive_type_view(i, ACK);
+        sync_lamport_time(msg->s_header.s_local_time);
+        uint32_t count;
+        memcpy(&count, msg->s_payload, sizeof(count));
+        completed += count;
+        release_view(msg);
     }
+    if (completed != expected)
+        fprintf(stderr, "Children completed %ld transfers out of %ld\n",
+                completed, expected);
+}
+
+/* ---------------- histories ---------------- */
+/* Histories reach the parent along the gather() tree, parts of different
+ * children interleaved; each child's points decode in order. */
+static BalanceChanges *gathered;    /* at the parent, one per child */
+
+static void take_history(local_id origin, const void *part, size_t len) {
+    decode_changes(part, len, &gathered[origin - 1]);
+}
+
+static void add_balances(void *acc, const void *in, size_t len) {
+    balance_t a, b;
+    (void)len;
+    memcpy(&a, acc, sizeof(a));
+    memcpy(&b, in, sizeof(b));
+    a += b;
+    memcpy(acc, &a, sizeof(a));
 }
 
 /* ---------------- parent ---------------- */
 void parent_work(int nproc) {
-    AllHistory all;
-    all.s_history_len = nproc - 1;
+    AllHistory *all;
+    node_count = nproc;
 
-    wait_all(STARTED, nproc, PARENT_ID);
-    bank_operations(nproc - 1);
+    sync_phase(STARTED, NULL, 0);
+    if (peer_transfers())
+        wait_peer_transfers(nproc);
+    else
+        bank_operations(nproc - 1);
 
-    Message stop;
-    fill_msg(&stop, STOP, NULL, 0);
-    send_multicast(&stop);
+    multicast_msg(STOP, NULL, 0);
 
-    wait_all(DONE, nproc, PARENT_ID);
+    sync_phase(DONE, NULL, 0);
 
-    Message msg;
-    for (int i = 1; i < nproc; ++i) {
-        do { receive(i, &msg); } while (msg.s_header.s_type != BALANCE_HISTORY);
-        sync_lamport_time(msg.s_header.s_local_time);
-        memcpy(&all.s_history[i - 1], msg.s_payload, msg.s_header.s_payload_len);
+    all = malloc(all_history_size(nproc - 1));
+    if (!all) { perror("malloc"); exit(EXIT_FAILURE); }
+    all->s_history_len = nproc - 1;
+    BalanceChanges *changes = calloc(nproc - 1, sizeof(*changes));
+    if (!changes) { perror("calloc"); exit(EXIT_FAILURE); }
+    gathered = changes;
+    gather(PARENT_ID, BALANCE_HISTORY, get_lamport_time(), NULL, take_history);
+    for (int i = 1; i < nproc; ++i)
+        changes_expand(&changes[i - 1], &all->s_history[i - 1]);
+    HistoryIndex index;
+    history_index_build(&index, changes, nproc - 1);
+    print_history(all);
+    timestamp_t bad = check_history(all);
+    if (bad >= 0)
+        fprintf(stderr, "Money is not conserved at time %" PRI_TIME "\n", bad);
+    free(all);
+
+    /* the children's final balances, added up on the way */
+    balance_t total = 0;
+    reduce(PARENT_ID, BALANCE_HISTORY, get_lamport_time(), &total, sizeof(total), add_balances);
+    if (total != total_at(&index, index.s_total.s_end - 1))
+        fprintf(stderr, "Final balances add up to $%" PRI_BALANCE ", the histories to $%" PRI_BALANCE "\n",
+                total, total_at(&index, index.s_total.s_end - 1));
+
+    /* the table stops at 255 ticks, a longer run also gets its end */
+    timestamp_t end = index.s_total.s_end - 1;
+    if (end >= UINT8_MAX)
+        printf("At time %" PRI_TIME ": total $%" PRI_BALANCE " with $%" PRI_BALANCE
+               " in flight, at most $%" PRI_BALANCE " in flight since 0\n",
+               end, total_at(&index, end), in_flight_at(&index, end), max_in_flight(&index, 0, end));
+    history_index_free(&index);
+}
+
+/* ---------------- windows and batches ---------------- */
+/* Transfers started here whose ACK has not come back yet. */
+enum { DEFAULT_TRANSFER_WINDOW = 16 };
+static int in_flight = 0;
+static int window = 0;
+
+static int transfer_window(void) {
+    if (window == 0) {
+        const char *env = getenv("TRANSFER_WINDOW");
+        window = env && atoi(env) > 0 ? atoi(env) : DEFAULT_TRANSFER_WINDOW;
     }
-    print_history(&all);
+    return window;
+}
+
+/* Orders per TRANSFER_BATCH; 1 sends every order as a plain TRANSFER. */
+static int batch_size(void) {
+    const char *env = getenv("TRANSFER_BATCH");
+    int n = env ? atoi(env) : 1;
+    return n < 1 ? 1 : n > MAX_TRANSFER_BATCH ? MAX_TRANSFER_BATCH : n;
 }
 
-/* ---------------- helper ---------------- */
-static void update_history(BalanceHistory *h, balance_t bal,
-                           timestamp_t from, timestamp_t to, balance_t pend) {
-    if (to > MAX_T) to = MAX_T;
-    for (timestamp_t t = from; t <= to; ++t) {
-        h->s_history[t].s_balance = bal;
-        h->s_history[t].s_balance_pending_in = pend;
-        h->s_history[t].s_time = t;
+/* One send event; orders that do not fit one message follow in the next
+ * with the same timestamp. */
+static void send_orders(local_id dst, const TransferOrder *ord, int n) {
+    char buf[MAX_PAYLOAD_LEN];
+    inc_lamport_time();
+    while (n > 0) {
+        size_t len = sizeof(buf);
+        int k = encode_orders(buf, &len, ord, n);
+        struct iovec v = { buf, len };
+        send_iov(dst, k == 1 ? TRANSFER : TRANSFER_BATCH, get_lamport_time(), &v, 1);
+        ord += k;
+        n -= k;
     }
-    if (to + 1 > h->s_history_len)
-        h->s_history_len = to + 1;
+}
+
+/* ---------------- cumulative ACKs ---------------- */
+/* With ACK_EVERY=<k> > 1, or with batches, destinations acknowledge with
+ * TransferAcks after k transfers or once nothing else is waiting to be
+ * read; otherwise every transfer gets its own empty ACK. */
+static int ack_every(void) {
+    const char *env = getenv("ACK_EVERY");
+    return env && atoi(env) > 0 ? atoi(env) : 1;
+}
+
+static int cumulative_acks(void) {
+    return ack_every() > 1 || batch_size() > 1;
+}
+
+static void *alloc_table(size_t n, size_t size) {
+    void *table = calloc(n, size);
+    if (!table) { perror("calloc"); exit(EXIT_FAILURE); }
+    return table;
+}
+
+/* Initiator side: transfers confirmed so far, [src * node_count + dst]. */
+static uint16_t *confirmed = NULL;
+
+/* Returns the number of transfers the ACK from dst retires. */
+static int confirm(local_id dst, const Message *ack) {
+    if (!ack->s_header.s_payload_len)
+        return 1;
+    if (!confirmed)
+        confirmed = alloc_table((size_t)node_count * node_count, sizeof(*confirmed));
+
+    const TransferAck *acks = (const TransferAck *)ack->s_payload;
+    int n = ack->s_header.s_payload_len / sizeof(*acks);
+    int retired = 0;
+    for (int i = 0; i < n; ++i) {
+        uint16_t *upto = &confirmed[acks[i].s_src * node_count + dst];
+        retired += (uint16_t)(acks[i].s_upto - *upto);
+        *upto = acks[i].s_upto;
+    }
+    return retired;
+}
+
+/* Destination side: transfers booked and reported per source, the sources
+ * booked from since the last ACK, and how many transfers that is. */
+static uint16_t *booked = NULL;
+static uint16_t *reported = NULL;
+static local_id *unreported = NULL;
+static int nunreported = 0;
+static int unacked = 0;
+
+/* Peer-initiated transfers are acknowledged to their source, the rest to
+ * the parent. */
+static void send_acks(void) {
+    TransferAck acks[MAX_PROCESS_ID];
+    int n = 0;
+    for (int i = 0; i < nunreported; ++i) {
+        local_id src = unreported[i];
+        TransferAck ack = { src, booked[src] };
+        reported[src] = booked[src];
+        if (peer_transfers())
+            send_msg(src, ACK, &ack, sizeof(ack));
+        else
+            acks[n++] = ack;
+    }
+    if (n)
+        send_msg(PARENT_ID, ACK, acks, n * sizeof(*acks));
+    nunreported = 0;
+    unacked = 0;
+}
+
+static void book(local_id src, int n) {
+    if (!booked) {
+        booked = alloc_table(node_count, sizeof(*booked));
+        reported = alloc_table(node_count, sizeof(*reported));
+        unreported = alloc_table(node_count, sizeof(*unreported));
+    }
+    if (booked[src] == reported[src])
+        unreported[nunreported++] = src;
+    booked[src] += n;
+    unacked += n;
+    if (unacked >= ack_every())
+        send_acks();
+}
+
+/* ---------------- moving money ---------------- */
+
+/* accounts of this child; the history records their sum */
+static AccountTable accounts;
+
+/* Source side: orders for the same destination leave together, the money
+ * is taken at that send event. */
+static void send_money(const TransferOrder *ord, int n, balance_t *bal, BalanceChanges *hist) {
+    char buf[BUF_SIZE];
+    TransferOrder group[MAX_TRANSFER_BATCH];
+    char taken[MAX_TRANSFER_BATCH] = {0};
+
+    for (int i = 0; i < n; ++i) {
+        if (taken[i]) continue;
+        int len = 0;
+        for (int j = i; j < n; ++j) {
+            if (!taken[j] && ord[j].s_dst == ord[i].s_dst) {
+                group[len++] = ord[j];
+                taken[j] = 1;
+            }
+        }
+
+        timestamp_t send_t = next_lamport_time();   /* send_orders() ticks */
+        for (int j = 0; j < len; ++j) {
+            *account_balance(&accounts, group[j].s_src_account) -= group[j].s_amount;
+            *bal -= group[j].s_amount;
+            snprintf(buf, sizeof(buf), log_transfer_out_fmt,
+                     send_t, group[j].s_src, group[j].s_amount, group[j].s_dst);
+            shared_logger(buf);
+        }
+        changes_set_balance(hist, send_t, *bal);
+        send_orders(ord[i].s_dst, group, len);
+    }
+}
+
+/* Destination side: the money was pending since the sender's timestamp. */
+static void receive_money(const TransferOrder *ord, int n, timestamp_t sent_t,
+                          balance_t *bal, BalanceChanges *hist, local_id ack_to) {
+    char buf[BUF_SIZE];
+    timestamp_t recv_t = get_lamport_time();
+    balance_t amount = 0;
+
+    for (int i = 0; i < n; ++i) {
+        *account_balance(&accounts, ord[i].s_dst_account) += ord[i].s_amount;
+        amount += ord[i].s_amount;
+        snprintf(buf, sizeof(buf), log_transfer_in_fmt,
+                 recv_t, ord[i].s_dst, ord[i].s_amount, ord[i].s_src);
+        shared_logger(buf);
+    }
+    /* transfers from several sources may overlap, their amounts add up;
+     * the range is only logged here and folded in when the history is sent */
+    changes_add_pending(hist, sent_t, recv_t, amount);
+    *bal += amount;
+    changes_set_balance(hist, recv_t, *bal);
+
+    if (cumulative_acks())
+        book(ord->s_src, n);
+    else
+        send_msg(ack_to, ACK, NULL, 0);
 }
 
 /* ---------------- child ---------------- */
+/* What the handlers of the main loop share. */
+static struct {
+    local_id self;
+    balance_t bal;
+    BalanceChanges hist;
+    int peer_total, peer_sent, peer_reported;
+    int running;
+} child;
+
+/* Start our own transfers as far as the window allows, report once all
+ * of them are ACKed. */
+static void start_peer_transfers(void) {
+    int children = node_count - 1;
+    while (child.peer_sent < child.peer_total && in_flight < transfer_window()) {
+        TransferOrder ord[MAX_TRANSFER_BATCH];
+        int n = 0;
+        while (n < batch_size() && child.peer_sent < child.peer_total && in_flight + n < transfer_window()) {
+            TransferOrder o = { child.self, peer_destination(child.self, child.peer_sent++, children), 1 };
+            ord[n++] = o;
+        }
+        send_money(ord, n, &child.bal, &child.hist);
+        in_flight += n;
+    }
+    if (!child.peer_reported && child.peer_sent == child.peer_total && in_flight == 0) {
+        uint32_t count = child.peer_sent;
+        send_msg(PARENT_ID, ACK, &count, sizeof(count));
+        child.peer_reported = 1;
+    }
+}
+
+static void on_transfer(local_id from, const Message *msg) {
+    /* a batch shares its source and, once forwarded, its destination */
+    TransferOrder ord[MAX_TRANSFER_BATCH];
+    int n = decode_orders(msg->s_payload, msg->s_header.s_payload_len, ord, MAX_TRANSFER_BATCH);
+    if (ord->s_src == child.self)
+        send_money(ord, n, &child.bal, &child.hist);
+    else if (ord->s_dst == child.self)
+        receive_money(ord, n, msg->s_header.s_local_time, &child.bal, &child.hist,
+                      peer_transfers() ? from : PARENT_ID);
+}
+
+static void on_ack(local_id from, const Message *msg) {
+    in_flight -= confirm(from, msg);
+    start_peer_transfers();
+}
+
+static void on_stop(local_id from, const Message *msg) {
+    child.running = 0;
+}
+
+/* ACKs are held back only while there is more to read */
+static void on_idle(void) {
+    if (unacked) send_acks();
+}
+
+static bool stopped(void) {
+    return !child.running;
+}
+
+/* DONE from peers that stopped first waits in its mailbox for sync_phase() */
+static const Handlers main_loop = {
+    .on = {
+        [TRANSFER] = on_transfer,
+        [TRANSFER_BATCH] = on_transfer,
+        [ACK] = on_ack,
+        [STOP] = on_stop,
+    },
+    .on_time = sync_lamport_time,
+    .on_idle = on_idle,
+};
+
+/* Our history for gather(), as many parts as the points take. */
+static uint32_t hist_sent = 0;
+
+static size_t next_history_part(void *buf, size_t cap) {
+    if (hist_sent == child.hist.s_len)
+        return 0;
+    hist_sent += encode_changes(buf, &cap, &child.hist, hist_sent);
+    return cap;
+}
+
 void child_work(struct child_arguments a) {
     local_id self = a.self_id;
     int nproc = a.count_nodes;
-    balance_t bal = a.balance;
-    BalanceHistory hist;
-    memset(&hist, 0, sizeof(hist));
-    hist.s_id = self;
-    update_history(&hist, bal, 0, 0, 0);
+    node_count = nproc;
+    child.self = self;
+    child.bal = a.balance;
+    *account_balance(&accounts, 0) = child.bal;
+    child.hist.s_id = self;
+    changes_set_balance(&child.hist, 0, child.bal);
 
     pid_t pid = getpid(), ppid = getppid();
     char buf[BUF_SIZE];
 
     /* STARTED --------------------------------------------------- */
     snprintf(buf, sizeof(buf), log_started_fmt,
-             get_lamport_time(), self, pid, ppid, bal);
-    Message started;
-    fill_msg(&started, STARTED, buf, strlen(buf));
+             get_lamport_time(), self, pid, ppid, child.bal);
     shared_logger(buf);
-    send_multicast(&started);
-
-    wait_all(STARTED, nproc, self);
+    sync_phase(STARTED, buf, strlen(buf));
     snprintf(buf, sizeof(buf), log_received_all_started_fmt,
              get_lamport_time(), self);
     shared_logger(buf);
 
     /* MAIN LOOP ------------------------------------------------- */
-    int running = 1;
-    Message msg;
-    while (running) {
-        receive_any(&msg);
-        sync_lamport_time(msg.s_header.s_local_time);
-
-        switch (msg.s_header.s_type) {
-        case TRANSFER: {
-            TransferOrder *ord = (TransferOrder *)msg.s_payload;
-            if (ord->s_src == self) {
-                /* sender - 关键修复：在发送时刻减少余额 */
-                Message fwd;
-                fill_msg(&fwd, TRANSFER, ord, sizeof(*ord));  // 先准备消息，时钟递增
-                
-                timestamp_t send_t = get_lamport_time();      // 获取发送时刻
-                bal -= ord->s_amount;                         // 在发送时刻减少余额
-                
-                snprintf(buf, sizeof(buf), log_transfer_out_fmt,
-                         send_t, self, ord->s_amount, ord->s_dst);
-                shared_logger(buf);
-                update_history(&hist, bal, send_t, send_t, 0);
-
-                send(ord->s_dst, &fwd);                       // 发送消息
-            } else if (ord->s_dst == self) {
-                /* receiver */
-                timestamp_t lm = msg.s_header.s_local_time;   // 发送方的时间戳
-                timestamp_t recv_t = get_lamport_time();      // 接收时刻
-                
-                // 标记pending: [lm, recv_t)
-                for (timestamp_t t = lm; t < recv_t && t <= MAX_T; t++) {
-                    if (t >= hist.s_history_len) {
-                        hist.s_history[t].s_balance = bal;
-                        hist.s_history[t].s_time = t;
-                    }
-                    hist.s_history[t].s_balance_pending_in = ord->s_amount;
-                }
-                
-                if (recv_t > hist.s_history_len) {
-                    hist.s_history_len = recv_t;
-                }
-                
-                bal += ord->s_amount;
-                update_history(&hist, bal, recv_t, recv_t, 0);
-                
-                snprintf(buf, sizeof(buf), log_transfer_in_fmt,
-                         recv_t, self, ord->s_amount, ord->s_src);
-                shared_logger(buf);
-                
-                Message ack;
-                fill_msg(&ack, ACK, NULL, 0);
-                send(PARENT_ID, &ack);
-            }
-            break;
-        }
-        case STOP:
-            running = 0;
-            break;
-        default:
-            break;
-        }
-    }
+    child.peer_total = nproc > 2 ? peer_transfers() : 0;
+    child.peer_reported = !peer_transfers();
+    child.running = 1;
+    start_peer_transfers();
+    run_reactor(&main_loop, stopped);
 
     /* DONE ------------------------------------------------------ */
     inc_lamport_time();
     snprintf(buf, sizeof(buf), log_done_fmt,
-             get_lamport_time(), self, bal);
+             get_lamport_time(), self, child.bal);
     shared_logger(buf);
-    Message done;
-    fill_msg(&done, DONE, buf, strlen(buf));
-    send_multicast(&done);
-
-    wait_all(DONE, nproc, self);
+    sync_phase(DONE, buf, strlen(buf));
+    account_table_free(&accounts);
     snprintf(buf, sizeof(buf), log_received_all_done_fmt,
              get_lamport_time(), self);
     shared_logger(buf);
 
     /* BALANCE HISTORY ------------------------------------------- */
     inc_lamport_time();
-    hist.s_history_len = get_lamport_time() + 1;
-    Message histmsg;
-    fill_msg(&histmsg, BALANCE_HISTORY, &hist, sizeof(hist));
-    send(PARENT_ID, &histmsg);
+    changes_set_balance(&child.hist, get_lamport_time(), child.bal);
+    gather(PARENT_ID, BALANCE_HISTORY, get_lamport_time(), next_history_part, NULL);
+    changes_free(&child.hist);
+    balance_t total = child.bal;
+    reduce(PARENT_ID, BALANCE_HISTORY, get_lamport_time(), &total, sizeof(total), add_balances);
 }
 
 /* ---------------- transfer() ---------------- */
-void transfer(local_id src, local_id dst, balance_t amount) {
+/* Orders transfer_async() holds back, one batch per source. */
+struct batch {
+    int len;
+    int listed;                 /* already in open_batches */
+    TransferOrder orders[MAX_TRANSFER_BATCH];
+};
+static struct batch *batches[MAX_PROCESS_ID + 1];
+static local_id open_batches[MAX_PROCESS_ID + 1];
+static int nopen = 0;
+
+static void flush_batch(local_id src) {
+    struct batch *b = batches[src];
+    if (b->len) {
+        send_orders(src, b->orders, b->len);
+        b->len = 0;
+    }
+}
+
+static void flush_batches(void) {
+    for (int i = 0; i < nopen; ++i) {
+        flush_batch(open_batches[i]);
+        batches[open_batches[i]]->listed = 0;
+    }
+    nopen = 0;
+}
+
+/* Destinations ACK in any order, each ACK retires the orders of one message.
+ * Returns the destination that sent it. */
+static local_id wait_ack(void) {
+    local_id from;
+    const Message *ack = receive_any_of_view(MESSAGE_TYPE_BIT(ACK), &from);
+    timestamp_t t = ack->s_header.s_local_time;
+    in_flight -= confirm(from, ack);
+    release_view(ack);
+    sync_lamport_time(t);
+    return from;
+}
+
+void transfer_async(local_id src, local_id dst, balance_t amount) {
+    while (in_flight >= transfer_window()) {
+        flush_batches();
+        wait_ack();
+    }
+
+    struct batch *b = batches[src];
+    if (!b && !(b = batches[src] = calloc(1, sizeof(*b)))) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    if (!b->listed) {
+        open_batches[nopen++] = src;
+        b->listed = 1;
+    }
+
     TransferOrder ord = {src, dst, amount};
-    Message msg;
-    fill_msg(&msg, TRANSFER, &ord, sizeof(ord));
-    send(src, &msg);
+    b->orders[b->len++] = ord;
+    ++in_flight;
+    if (b->len == batch_size())
+        flush_batch(src);
+}
+
+void wait_transfers(void) {
+    flush_batches();
+    while (in_flight > 0)
+        wait_ack();
+}
+
+void transfer(local_id src, local_id dst, balance_t amount) {
+    transfer_async(src, dst, amount);
+    wait_transfers();
+}
+
+/* Orders transfer_orders() looks at past the oldest waiting one, per slot
+ * of the window. */
+enum { LOOKAHEAD_PER_SLOT = 4 };
+
+void transfer_orders(const TransferOrder *orders, int n) {
+    /* accounts in flight map to the other end of their transfer (0 when
+     * idle); claimed[] is the pass in which a waiting order reserved one */
+    local_id *partner = alloc_table(node_count, sizeof(*partner));
+    int *claimed = alloc_table(node_count, sizeof(*claimed));
+    char *issued = alloc_table(n ? n : 1, 1);
+    int lookahead = LOOKAHEAD_PER_SLOT * transfer_window();
+
+    wait_transfers();
+    for (int head = 0, pass = 1; head < n; ++pass) {
+        for (int i = head, seen = 0;
+             i < n && seen < lookahead && in_flight < transfer_window(); ++i) {
+            if (issued[i]) continue;
+            ++seen;
 
-    Message ack;
-    do { receive_any(&ack); } while (ack.s_header.s_type != ACK);
-    sync_lamport_time(ack.s_header.s_local_time);
+            local_id src = orders[i].s_src, dst = orders[i].s_dst;
+            if (partner[src] || partner[dst] || claimed[src] == pass || claimed[dst] == pass) {
+                claimed[src] = claimed[dst] = pass;     /* later ones queue up */
+                continue;
+            }
+            partner[src] = dst;
+            partner[dst] = src;
+            issued[i] = 1;
+            transfer_async(src, dst, orders[i].s_amount);
+        }
+        while (head < n && issued[head]) ++head;
+
+        /* every account is in at most one transfer, so the ACK names it */
+        if (in_flight) {
+            flush_batches();
+            local_id dst = wait_ack();
+            partner[partner[dst]] = 0;
+            partner[dst] = 0;
+        }
+    }
+    wait_transfers();
+
+    free(partner);
+    free(claimed);
+    free(issued);
 }
 
 /* ---------------- example bank ops ---------------- */
+/* orders taken from a -w workload at a time */
+enum { WORKLOAD_CHUNK = 4096 };
+
 __attribute__((weak))
 void bank_operations(local_id max_id) {
-    for (local_id i = 1; i < max_id; ++i)
-        transfer(i, i + 1, i);
-    if (max_id > 1)
-        transfer(max_id, 1, 1);
+    /* a workload given with -w replaces the ring */
+    static TransferOrder chunk[WORKLOAD_CHUNK];
+    int n = workload_orders(max_id, chunk, WORKLOAD_CHUNK);
+    if (n > 0) {
+        do transfer_orders(chunk, n);
+        while ((n = workload_orders(max_id, chunk, WORKLOAD_CHUNK)) > 0);
+        return;
+    }
+
+    TransferOrder *orders = alloc_table(max_id, sizeof(*orders));
+    n = 0;
+    for (local_id i = 1; i < max_id; ++i) {
+        TransferOrder o = { i, i + 1, i };
+        orders[n++] = o;
+    }
+    if (max_id > 1) {
+        TransferOrder o = { max_id, 1, 1 };
+        orders[n++] = o;
+    }
+    transfer_orders(orders, n);
+    free(orders);
 }
@@ -2,12 +2,14 @@
 #define _DEFAULT_SOURCE
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/types.h>
 
 #include "message.h"
+#include "ipc.h"
 #include "log.h"
 #include "process.h"
 
@@ -37,33 +39,59 @@ static int process_count = 0;
 static bool am_requesting = false;
 static timestamp_t my_request_time = 0;
 static int reply_count = 0;
-static bool deferred_replies[MAX_PROCESS_ID + 1];
+static uint64_t *deferred_replies = NULL;
 
 // DONE tracking
-static bool received_done[MAX_PROCESS_ID + 1];
+static uint64_t *received_done = NULL;
 static int done_counter = 0;
 
+/* ============ Peer Sets ============ */
+// One bit per process, sized from the process count at startup
+enum { SET_BITS = 64 };
+
+static int set_words(void) {
+    return (process_count + SET_BITS - 1) / SET_BITS;
+}
+
+static uint64_t *set_new(void) {
+    uint64_t *set = calloc(set_words(), sizeof(*set));
+    if (set == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return set;
+}
+
+static bool set_test(const uint64_t *set, local_id i) {
+    return (set[i / SET_BITS] >> (i % SET_BITS)) & 1;
+}
+
+static void set_add(uint64_t *set, local_id i) {
+    set[i / SET_BITS] |= (uint64_t) 1 << (i % SET_BITS);
+}
+
 /* ============ Helper Functions ============ */
-static void create_message(Message *msg, MessageType type, const char *payload) {
+// Messages go on the wire straight from their source, no Message buffer
+static void send_message(local_id dst, MessageType type) {
+    inc_lamport_time();
+    send_iov(dst, type, get_lamport_time(), NULL, 0);
+}
+
+static void multicast_message(MessageType type, const char *payload) {
     inc_lamport_time();
-    
-    msg->s_header.s_magic = MESSAGE_MAGIC;
-    msg->s_header.s_type = type;
-    msg->s_header.s_local_time = get_lamport_time();
     
     if (payload != NULL) {
-        size_t len = strlen(payload);
-        msg->s_header.s_payload_len = len;
-        memcpy(msg->s_payload, payload, len);
+        struct iovec iov = { (void *) payload, strlen(payload) };
+        send_multicast_iov(type, get_lamport_time(), &iov, 1);
     } else {
-        msg->s_header.s_payload_len = 0;
+        send_multicast_iov(type, get_lamport_time(), NULL, 0);
     }
 }
 
 static void mark_done_received(local_id from) {
     if (from > 0 && from < process_count && from != my_id) {
-        if (!received_done[from]) {
-            received_done[from] = true;
+        if (!set_test(received_done, from)) {
+            set_add(received_done, from);
             done_counter++;
         }
     }
@@ -89,66 +117,73 @@ static void handle_cs_request_msg(local_id from, timestamp_t req_time) {
     }
     
     if (should_reply_now) {
-        Message reply;
-        create_message(&reply, CS_REPLY, NULL);
-        send(from, &reply);
+        send_message(from, CS_REPLY);
     } else {
-        deferred_replies[from] = true;
+        set_add(deferred_replies, from);
     }
 }
 
+/* ============ Message Handlers ============ */
+// A process that is not requesting grants at once, so this serves every phase
+static void on_cs_request(local_id from, const Message *msg) {
+    handle_cs_request_msg(from, msg->s_header.s_local_time);
+}
+
+static void on_cs_reply(local_id from, const Message *msg) {
+    reply_count++;
+}
+
+static void on_done(local_id from, const Message *msg) {
+    mark_done_received(from);
+}
+
+static bool all_replied(void) {
+    return reply_count >= process_count - 1; // All except self
+}
+
+static bool all_done(void) {
+    // All children except self
+    return done_counter >= process_count - 1 - (my_id != PARENT_ID);
+}
+
+// Handler sets of the phases; a type without a handler waits for a later phase
+static const Handlers parent_phase = {
+    .on = { [CS_REQUEST] = on_cs_request, [DONE] = on_done },
+    .on_time = update_lamport_time,
+};
+
+static const Handlers waiting_for_replies = {
+    .on = { [CS_REPLY] = on_cs_reply, [CS_REQUEST] = on_cs_request, [DONE] = on_done },
+    .on_time = update_lamport_time,
+};
+
+// DONE is no barrier(): peers still waiting for their CS_REPLY must get it meanwhile
+static const Handlers done_phase = {
+    .on = { [DONE] = on_done, [CS_REQUEST] = on_cs_request },
+    .on_time = update_lamport_time,
+};
+
 static void enter_critical_section(void) {
     am_requesting = true;
     reply_count = 0;
     
     // Send CS_REQUEST to all processes
-    Message request;
-    create_message(&request, CS_REQUEST, NULL);
-    my_request_time = request.s_header.s_local_time;
-    
-    for (local_id i = 0; i < process_count; i++) {
-        if (i != my_id) {
-            send(i, &request);
-        }
-    }
+    multicast_message(CS_REQUEST, NULL);
+    my_request_time = get_lamport_time();
     
     // Wait for all replies
-    int needed_replies = process_count - 1; // All except self
-    
-    while (reply_count < needed_replies) {
-        Message msg;
-        local_id sender = receive_any(&msg);
-        update_lamport_time(msg.s_header.s_local_time);
-        
-        switch (msg.s_header.s_type) {
-            case CS_REPLY:
-                reply_count++;
-                break;
-            
-            case CS_REQUEST:
-                handle_cs_request_msg(sender, msg.s_header.s_local_time);
-                break;
-            
-            case DONE:
-                mark_done_received(sender);
-                break;
-            
-            default:
-                break;
-        }
-    }
+    run_reactor(&waiting_for_replies, all_replied);
 }
 
 static void leave_critical_section(void) {
     am_requesting = false;
     
-    // Send deferred replies
-    for (local_id i = 0; i < process_count; i++) {
-        if (deferred_replies[i]) {
-            Message reply;
-            create_message(&reply, CS_REPLY, NULL);
-            send(i, &reply);
-            deferred_replies[i] = false;
+    // Send deferred replies, skipping whole words nobody is waiting in
+    for (int w = 0; w < set_words(); w++) {
+        while (deferred_replies[w]) {
+            int bit = __builtin_ctzll(deferred_replies[w]);
+            deferred_replies[w] &= deferred_replies[w] - 1;
+            send_message(w * SET_BITS + bit, CS_REPLY);
         }
     }
 }
@@ -157,32 +192,14 @@ static void leave_critical_section(void) {
 void parent_work(int count_nodes) {
     process_count = count_nodes;
     my_id = PARENT_ID;
+    set_coalescing(true);
     
-    int done_received_count = 0;
-    int expected_done = count_nodes - 1; // All children
-    
-    while (done_received_count < expected_done) {
-        Message msg;
-        local_id sender = receive_any(&msg);
-        update_lamport_time(msg.s_header.s_local_time);
-        
-        switch (msg.s_header.s_type) {
-            case CS_REQUEST: {
-                // Parent always grants permission immediately
-                Message reply;
-                create_message(&reply, CS_REPLY, NULL);
-                send(sender, &reply);
-                break;
-            }
-            
-            case DONE:
-                done_received_count++;
-                break;
-            
-            default:
-                break;
-        }
-    }
+    update_lamport_time(barrier(STARTED, get_lamport_time(), NULL, 0));
+
+    // Parent never requests, so it grants every CS_REQUEST immediately
+    received_done = set_new();
+    run_reactor(&parent_phase, all_done);
+    free(received_done);
 }
 
 /* ============ Child Process ============ */
@@ -191,46 +208,24 @@ void child_work(struct child_arguments args) {
     process_count = args.count_nodes;
     bool use_mutex = args.mutex_usage;
     
+    // Replies and requests to the same peer leave in one write
+    set_coalescing(true);
+    
     // Initialize state
-    for (int i = 0; i <= MAX_PROCESS_ID; i++) {
-        deferred_replies[i] = false;
-        received_done[i] = false;
-    }
+    deferred_replies = set_new();
+    received_done = set_new();
     done_counter = 0;
     
     char buffer[BUF_SIZE];
     
     /* ========== PHASE 1: STARTED ========== */
     snprintf(buffer, BUF_SIZE, log_started_fmt,
-             get_lamport_time(), my_id, getpid(), getppid(), 0);
+             get_lamport_time(), my_id, getpid(), getppid(), (balance_t) 0);
     shared_logger(buffer);
     
-    Message started_msg;
-    create_message(&started_msg, STARTED, buffer);
-    send_multicast(&started_msg);
-    
-    // Wait for STARTED from all other children
-    int started_count = 0;
-    int expected_started = process_count - 2; // All except self and parent
-    
-    while (started_count < expected_started) {
-        Message msg;
-        local_id sender = receive_any(&msg);
-        update_lamport_time(msg.s_header.s_local_time);
-        
-        switch (msg.s_header.s_type) {
-            case STARTED:
-                started_count++;
-                break;
-            
-            case CS_REQUEST:
-                handle_cs_request_msg(sender, msg.s_header.s_local_time);
-                break;
-            
-            default:
-                break;
-        }
-    }
+    // Wait for STARTED from all other children, early CS_REQUESTs wait in their mailbox
+    inc_lamport_time();
+    update_lamport_time(barrier(STARTED, get_lamport_time(), buffer, strlen(buffer)));
     
     snprintf(buffer, BUF_SIZE, log_received_all_started_fmt,
              get_lamport_time(), my_id);
@@ -255,40 +250,18 @@ void child_work(struct child_arguments args) {
     
     /* ========== PHASE 3: DONE ========== */
     snprintf(buffer, BUF_SIZE, log_done_fmt,
-             get_lamport_time(), my_id, 0);
+             get_lamport_time(), my_id, (balance_t) 0);
     shared_logger(buffer);
     
-    Message done_msg;
-    create_message(&done_msg, DONE, buffer);
-    send_multicast(&done_msg);
-    
-    // Wait for DONE from all other children
-    int expected_done = process_count - 2;
+    multicast_message(DONE, buffer);
     
-    while (done_counter < expected_done) {
-        Message msg;
-        local_id sender = receive_any(&msg);
-        update_lamport_time(msg.s_header.s_local_time);
-        
-        switch (msg.s_header.s_type) {
-            case DONE:
-                mark_done_received(sender);
-                break;
-            
-            case CS_REQUEST: {
-                // Always reply immediately in phase 3
-                Message reply;
-                create_message(&reply, CS_REPLY, NULL);
-                send(sender, &reply);
-                break;
-            }
-            
-            default:
-                break;
-        }
-    }
+    // Wait for DONE from all other children, granting every CS_REQUEST
+    run_reactor(&done_phase, all_done);
     
     snprintf(buffer, BUF_SIZE, log_received_all_done_fmt,
              get_lamport_time(), my_id);
     shared_logger(buffer);
+
+    free(deferred_replies);
+    free(received_done);
 }
@@ -11,20 +11,47 @@
 
 #include "message.h"
 
+#ifdef MODEL_WIDE
+typedef int64_t balance_t;
+#define PRI_BALANCE PRId64      ///< printf conversion for balance_t
+#else
 typedef int16_t balance_t;
+#define PRI_BALANCE "d"
+#endif
 
 /**
  * 1. "Main process" sends TransferOrder to process with id=s_src.
  * 2. s_src decreases its balance by s_amount and sends TransferOrder to s_dst.
  * 3. s_dst increases its balance by s_amount.
  * 4. s_dst sends ACK to "main process".
+ *
+ * Every child hosts a shard of accounts.  Account 0 starts with the child's
+ * balance, any other comes into being at 0 when a transfer first names it.
  */
 typedef struct {
     local_id   s_src;           ///< transfer from process with this ID
     local_id   s_dst;           ///< transfer to process with this ID
     balance_t  s_amount;        ///< Money
+    uint32_t   s_src_account;   ///< account of s_src to take the money from
+    uint32_t   s_dst_account;   ///< account of s_dst to put the money to
 } __attribute__((packed)) TransferOrder;
 
+enum {
+    MAX_TRANSFER_BATCH = 256    ///< max TransferOrders per TRANSFER_BATCH
+};
+
+/**
+ * Cumulative acknowledgement, an ACK carries one per source.  Channels are
+ * FIFO, so transfers from s_src to the acknowledging process are numbered
+ * 1, 2, ... in the order they travel on either end; s_upto says every one
+ * up to that number is booked.  It wraps around at 65536, so fewer than
+ * that may be unacknowledged per pair.
+ */
+typedef struct {
+    local_id   s_src;           ///< source the transfers came from
+    uint16_t   s_upto;          ///< last booked transfer from s_src
+} __attribute__((packed)) TransferAck;
+
 typedef struct {
     balance_t   s_balance;
     timestamp_t s_time; 
@@ -50,12 +77,71 @@ typedef struct {
 /**
  * Should contain balance histories of all processes in the distributed system
  * except parrent process.
+ * Allocate it with all_history_size(number of children) bytes.
  */
 typedef struct {
-    uint8_t          s_history_len; ///< should be equal to the number of children
-    BalanceHistory   s_history[MAX_PROCESS_ID + 1];
+    uint16_t         s_history_len; ///< should be equal to the number of children
+    BalanceHistory   s_history[];
 } AllHistory;
 
+static inline size_t all_history_size(int children) {
+    return sizeof(AllHistory) + children * sizeof(BalanceHistory);
+}
+
+/** Step in what is pending: s_amount more from s_time on. */
+typedef struct {
+    timestamp_t s_time;
+    balance_t   s_amount;
+} PendingDelta;
+
+/**
+ * Balance history of one process kept as change points: the state at time
+ * t is the last point with s_time <= t, up to s_end.  Its size follows the
+ * number of transfers, not the clock.  Zero-initialize it, start it with
+ * changes_set_balance(c, 0, balance), release it with changes_free().
+ *
+ * Pending ranges are logged as a difference array of PendingDelta and
+ * folded into the points when the history is encoded, expanded or indexed.
+ */
+typedef struct {
+    local_id      s_id;
+    timestamp_t   s_end;        ///< the history covers times [0;s_end)
+    uint32_t      s_len;        ///< points in use
+    uint32_t      s_cap;        ///< points allocated
+    BalanceState *s_points;     ///< by increasing s_time, the first at 0
+    uint32_t      s_deltas_len; ///< deltas not folded into the points yet
+    uint32_t      s_deltas_cap; ///< deltas allocated
+    PendingDelta *s_deltas;     ///< in the order they were added
+} BalanceChanges;
+
+/**
+ * Index over the collected histories of all children for queries by time.
+ * Build it with history_index_build(), release it with history_index_free().
+ */
+typedef struct {
+    int             s_children;
+    BalanceChanges *s_changes;      ///< s_changes[id - 1] belongs to child id
+    BalanceChanges  s_total;        ///< sums over all children, s_id 0
+    balance_t      *s_max_pending;  ///< max-tree over the pending of s_total
+    uint32_t        s_leaves;       ///< leaves of that tree, a power of two
+} HistoryIndex;
+
+enum {
+    NO_ACCOUNT = UINT32_MAX     ///< reserved, not a valid account id
+};
+
+/**
+ * Balances of the accounts of one shard, hashed by account id.
+ * Zero-initialize it before use, release it with account_table_free().
+ */
+typedef struct {
+    uint32_t  *keys;            ///< account ids, NO_ACCOUNT in free slots
+    balance_t *balances;        ///< balances[i] belongs to keys[i]
+    uint32_t   capacity;        ///< slots, a power of two
+    uint32_t   count;           ///< accounts in the table
+    uint32_t   shift;           ///< 32 - log2(capacity)
+} AccountTable;
+
 //------------------------------------------------------------------------------
 // Functions below must be implemented by students
 //------------------------------------------------------------------------------
@@ -68,6 +154,35 @@ typedef struct {
  */
 void transfer(local_id src, local_id dst, balance_t amount);
 
+/** Start a transfer like transfer() does, without waiting for its ACK.
+ *
+ * Blocks only while the window of transfers in flight is full; its size
+ * comes from the TRANSFER_WINDOW environment variable.
+ * Orders to the same source may be held back and leave together as one
+ * TRANSFER_BATCH of at most TRANSFER_BATCH (environment, default 1) orders.
+ * Destinations acknowledge every ACK_EVERY (environment, default 1)
+ * transfers, or sooner once they have nothing else to read.
+ *
+ * @param src       id of child process, which is source of transferring
+ * @param dst       id of child process, which is destination of transferring
+ * @param amount    amount of money, which should be transferred
+ */
+void transfer_async(local_id src, local_id dst, balance_t amount);
+
+/** Wait until every transfer started by transfer_async() is acknowledged. */
+void wait_transfers(void);
+
+/** Run a list of transfers, as many at a time as the window allows.
+ *
+ * Transfers that share no account with an earlier one still in flight or
+ * waiting start right away; the others keep their order, so every account
+ * sees its transfers in list order.  Returns once all are acknowledged.
+ *
+ * @param orders    transfers to run
+ * @param n         number of orders
+ */
+void transfer_orders(const TransferOrder *orders, int n);
+
 //------------------------------------------------------------------------------
 // Functions below are implemented by lector
 //------------------------------------------------------------------------------
@@ -79,6 +194,118 @@ void transfer(local_id src, local_id dst, balance_t amount);
  */
 void bank_operations(local_id max_id);
 
+/** Take the next orders of the workload chosen with -w.
+ *
+ * -w PATTERN[:key=value,...] selects uniform, zipf, all-to-one or pairs;
+ * the keys are n (transfers, 1000), amount (A or A-B, 1), seed (1),
+ * s (Zipf exponent, 1.0), to (all-to-one target, 1) and accounts (per
+ * child, uniform on either end, 1).
+ *
+ * @param max_id    highest child id
+ * @param orders    buffer for at least n orders
+ * @param n         max number of orders to take
+ *
+ * @return number of orders taken, 0 once the workload is used up or
+ *         without -w
+ */
+int workload_orders(local_id max_id, TransferOrder *orders, int n);
+
+/** Find the balance of an account, adding the account at 0 if it is new.
+ *
+ * The pointer stays valid until the next account is added.
+ *
+ * @param table     accounts of the shard
+ * @param id        account id, anything but NO_ACCOUNT
+ */
+balance_t *account_balance(AccountTable *table, uint32_t id);
+
+/** Release the memory of the table and leave it empty. */
+void account_table_free(AccountTable *table);
+
+/** Encode orders into a TRANSFER or TRANSFER_BATCH payload.
+ *
+ * Every field travels as a varint (7 bits a byte, signed fields zigzagged),
+ * so small ids, amounts and accounts take a byte or two whatever the width
+ * of balance_t.  Encoding stops at the first order that does not fit.
+ *
+ * @param buf       payload buffer
+ * @param len       in: size of buf, out: bytes used
+ * @param orders    orders to encode
+ * @param n         number of orders
+ *
+ * @return number of orders encoded
+ */
+int encode_orders(void *buf, size_t *len, const TransferOrder *orders, int n);
+
+/** Decode a TRANSFER or TRANSFER_BATCH payload, terminates if it is malformed.
+ *
+ * @return number of orders decoded, at most max
+ */
+int decode_orders(const void *buf, size_t len, TransferOrder *orders, int max);
+
+/** Encode change points into a BALANCE_HISTORY payload.
+ *
+ * A long history takes several messages: each carries the points from
+ * index `from` on that fit, as varint differences to the previous point.
+ *
+ * @param buf       payload buffer
+ * @param len       in: size of buf, out: bytes used
+ * @param changes   history to send, pending deltas are folded in first
+ * @param from      index of the first point to encode
+ *
+ * @return number of points encoded
+ */
+uint32_t encode_changes(void *buf, size_t *len, BalanceChanges *changes, uint32_t from);
+
+/** Append the points of a BALANCE_HISTORY payload, terminates if it is malformed.
+ *
+ * Feed it the messages of one sender in order, starting with zeroed changes.
+ *
+ * @return number of points still to come, 0 once the history is complete
+ */
+uint32_t decode_changes(const void *buf, size_t len, BalanceChanges *changes);
+
+/** Set the balance from time t on, keeping what is pending. */
+void changes_set_balance(BalanceChanges *changes, timestamp_t t, balance_t balance);
+
+/** Add amount to what is pending during [from;to), O(1) amortized.
+ *
+ * Overlapping ranges add up.
+ */
+void changes_add_pending(BalanceChanges *changes, timestamp_t from, timestamp_t to, balance_t amount);
+
+/** Expand change points into one state per tick for print_history().
+ *
+ * Covers [0;s_end), cut at the 255 ticks a BalanceHistory holds.
+ */
+void changes_expand(BalanceChanges *changes, BalanceHistory *history);
+
+/** Release the points and leave the changes empty. */
+void changes_free(BalanceChanges *changes);
+
+/** Index the histories of all children, O(P log P) for P points in all.
+ *
+ * @param index     index to build
+ * @param changes   array of one history per child, the index owns it from now on
+ * @param children  number of children
+ */
+void history_index_build(HistoryIndex *index, BalanceChanges *changes, int children);
+
+/** Balance of child id at time t, O(log P). */
+balance_t balance_at(const HistoryIndex *index, local_id id, timestamp_t t);
+
+/** Sum of the balances of all children at time t, O(log P). */
+balance_t total_at(const HistoryIndex *index, timestamp_t t);
+
+/** Money in flight (pending at the destinations) at time t, O(log P). */
+balance_t in_flight_at(const HistoryIndex *index, timestamp_t t);
+
+/** Most money in flight at any time in [from;to], O(log P). */
+balance_t max_in_flight(const HistoryIndex *index, timestamp_t from, timestamp_t to);
+
+/** Release the index together with the histories it owns. */
+void history_index_free(HistoryIndex *index);
+
 /** Returns perfect physical time.
  *
  * Emulates physical clock (for each process).
@@ -97,4 +324,13 @@ timestamp_t get_physical_time_skew();
  */
 void print_history(const AllHistory * history);
 
+/** Check that money is conserved in the histories.
+ *
+ * Balance plus pending, summed over all children, must be the same at
+ * every time as at 0.
+ *
+ * @return first time at which it is not, -1 if there is none
+ */
+timestamp_t check_history(const AllHistory * history);
+
 #endif // ITMO_HDU_DISTRIBUTED_SYSTEMS_BANKING_H
@@ -9,32 +9,51 @@
 #ifndef ITMO_HDU_DISTRIBUTED_SYSTEMS_MESSAGE_H
 #define ITMO_HDU_DISTRIBUTED_SYSTEMS_MESSAGE_H
 
+#include <inttypes.h>
 #include <stddef.h>
 #include <stdint.h>
 
 //------------------------------------------------------------------------------
 
-typedef int8_t local_id;
+/** Highest child id accepted by -p.  Per-process state is sized at run time,
+ * so only libdistributedmodel has to be rebuilt with a different value. */
+#ifndef MODEL_MAX_PROCESS_ID
+#define MODEL_MAX_PROCESS_ID 1023
+#endif
+
+typedef int16_t local_id;
+
+/** Build everything with MODEL_WIDE defined (make WIDE=1) for 64-bit clocks
+ * and balances; libdistributedmodel and the labs must agree. */
+#ifdef MODEL_WIDE
+typedef int64_t timestamp_t;
+#define TIMESTAMP_MAX INT64_MAX
+#define PRI_TIME PRId64         ///< printf conversion for timestamp_t
+#else
 typedef int16_t timestamp_t;
+#define TIMESTAMP_MAX INT16_MAX
+#define PRI_TIME "d"
+#endif
 
 enum {
     MESSAGE_MAGIC = 0xAFAF,
     MAX_MESSAGE_LEN = 4096,
     PARENT_ID = 0,
-    MAX_PROCESS_ID = 15,
+    MAX_PROCESS_ID = MODEL_MAX_PROCESS_ID,
     BUF_SIZE = 256
 };
 
 typedef enum {
     STARTED = 0,     ///< message with string (doesn't include trailing '\0')
     DONE,            ///< message with string (doesn't include trailing '\0')
-    ACK,             ///< empty message
+    ACK,             ///< empty message, or TransferAcks (see banking.h)
     STOP,            ///< empty message
-    TRANSFER,        ///< message with TransferOrder
-    BALANCE_HISTORY, ///< message with BalanceHistory
+    TRANSFER,        ///< message with a TransferOrder (see encode_orders())
+    BALANCE_HISTORY, ///< message with BalanceChanges (see encode_changes())
     CS_REQUEST,      ///< empty message
     CS_REPLY,        ///< empty message
-    CS_RELEASE       ///< empty message
+    CS_RELEASE,      ///< empty message
+    TRANSFER_BATCH   ///< message with TransferOrders sharing one s_src (see encode_orders())
 } MessageType;
 
 typedef struct {